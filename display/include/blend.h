@@ -0,0 +1,24 @@
+// include/blend.h
+#ifndef BLEND_H
+#define BLEND_H
+
+#include <stdint.h>
+#include <linux/fb.h>
+
+// Alpha blending on 32bpp XRGB/ARGB pixels. These read the destination, so
+// they must only ever run on the cached shadow buffer, never on the
+// write-combined device mapping; present_frame() pushes the result out.
+
+// Premultiplied-alpha Porter-Duff "over": dst = src + dst * (255 - src.a) / 255
+void blend_over_span(uint32_t *dst, const uint32_t *src, int count);
+// Constant-alpha fill: dst = color * alpha + dst * (255 - alpha)
+void blend_fill_span(uint32_t *dst, uint32_t color, int alpha, int count);
+// Constant-alpha blit of opaque pixels: dst = src * alpha + dst * (255 - alpha)
+void blend_blit_span(uint32_t *dst, const uint32_t *src, int alpha, int count);
+
+// Clipped rectangle helpers on a framebuffer laid out like vinfo
+void blend_fill_rect(int *framebuffer, struct fb_var_screeninfo vinfo, int x, int y, int w, int h, int color, int alpha);
+void blend_over_rect(int *framebuffer, struct fb_var_screeninfo vinfo, const uint32_t *src, int src_stride, int x, int y, int w, int h);
+void blend_blit_rect(int *framebuffer, struct fb_var_screeninfo vinfo, const uint32_t *src, int src_stride, int x, int y, int w, int h, int alpha);
+
+#endif
@@ -13,27 +13,108 @@
 #include <string.h> 
 #include <sys/ioctl.h>
 #include <errno.h>
+#include "fixed.h"
+#include "wallpaper.h"
+#include "graph.h"
 
 
+// The face is laid out for 800x600; panels at least twice that in both
+// directions draw at a smaller logical resolution and are scaled up
 #define SCREEN_WIDTH 800
 #define SCREEN_HEIGHT 600
-#define CENTER_X (SCREEN_WIDTH / 2)
-#define CENTER_Y (SCREEN_HEIGHT / 2)
+// Layout follows the resolution being drawn (the `vinfo` in scope)
+#define CENTER_X layout_center_x(vinfo)
+#define CENTER_Y layout_center_y(vinfo)
 #define RADIUS 200
+#define FACE_MARGIN 20      // Room for the numerals outside RADIUS
+#define STATS_TOP 290       // Panel below the face: its top, from the centre
+#define STATS_WIDTH 420
+#define STATS_HEIGHT 200
+#define STATS_LABELS 160    // Label column; bars and graphs start this far into the panel
+#define TEXT_BELOW 270      // Date and time reach this far below the centre
 #define HOUR_HAND_LENGTH 100
 #define MINUTE_HAND_LENGTH 150
+#define HOUR_HAND_WIDTH 7
+#define MINUTE_HAND_WIDTH 4
+#define HISTORY_WIDTH 240   // Seconds of stats history in each graph
+#define HISTORY_HEIGHT 30
 
 typedef struct {
     int x;
     int y;
 } Point;
 
+// The stats panel goes under the face when the panel is tall enough for
+// both (710 px); on shorter ones, such as 800x600, it goes beside the dial
+static inline int layout_stats_beside(struct fb_var_screeninfo vinfo) {
+    return (int)vinfo.yres < RADIUS + FACE_MARGIN + STATS_TOP + STATS_HEIGHT;
+}
+
+// Centred, or with the stats beside it, the dial and panel centred as a
+// pair; never so far left that the numerals are cut off
+static inline int layout_center_x(struct fb_var_screeninfo vinfo) {
+    if (!layout_stats_beside(vinfo)) return (int)vinfo.xres / 2;
+    int x = ((int)vinfo.xres - STATS_WIDTH) / 2;  // Half the space the pair leaves, then the dial's half width
+    return x < RADIUS + FACE_MARGIN ? RADIUS + FACE_MARGIN : x;
+}
+
+// Centre the face unless that pushes what is below it (the date, and the
+// stats when they are there) off the bottom; never so high that the
+// numerals are cut off
+static inline int layout_center_y(struct fb_var_screeninfo vinfo) {
+    int below = layout_stats_beside(vinfo) ? TEXT_BELOW : STATS_TOP + STATS_HEIGHT + 10;
+    int y = (int)vinfo.yres / 2;
+    if (y > (int)vinfo.yres - below) y = (int)vinfo.yres - below;
+    if (y < RADIUS + FACE_MARGIN) y = RADIUS + FACE_MARGIN;
+    return y;
+}
+
+// The stats panel: under the face, or beside the dial and level with it.
+// It is kept on screen: moved in under the face, narrowed to what is left
+// beside it, the graphs then showing only their newest samples.
+struct stats_box {
+    int x, y, w, h;
+};
+
+static inline struct stats_box layout_stats(struct fb_var_screeninfo vinfo) {
+    struct stats_box box = { CENTER_X - 110, CENTER_Y + STATS_TOP, STATS_WIDTH, STATS_HEIGHT };
+    if (layout_stats_beside(vinfo)) {
+        box.x = CENTER_X + RADIUS + FACE_MARGIN;
+        box.y = CENTER_Y - STATS_HEIGHT / 2;
+    } else if (box.x + box.w > (int)vinfo.xres) {
+        box.x = (int)vinfo.xres - box.w;
+    }
+    if (box.x < 0) box.x = 0;
+    if (box.x + box.w > (int)vinfo.xres) box.w = (int)vinfo.xres - box.x;
+    if (box.y + box.h > (int)vinfo.yres) box.y = (int)vinfo.yres - box.h;
+    if (box.y < 0) box.y = 0;
+    if (box.y + box.h > (int)vinfo.yres) box.h = (int)vinfo.yres - box.y;
+    return box;
+}
+
+#ifdef FB_FIXED_POINT
+typedef fx_angle_t angle_t;
+#else
+typedef float angle_t;
+#endif
+
+// One reading of the system stats, taken once and drawn on every head
+struct sysinfo_snapshot {
+    int battery;
+    int cpu;
+    int ram;
+    int disk;
+    int cpu_temp;
+    unsigned long samples;  // Readings taken so far, this one included
+};
+
 void draw_circle(int *framebuffer, struct fb_var_screeninfo vinfo);
-void draw_hand(int *framebuffer, struct fb_var_screeninfo vinfo, float angle, int length, int color);
-void draw_clock_face(int *framebuffer, struct fb_var_screeninfo vinfo);
-void update_time(int *framebuffer, struct fb_var_screeninfo vinfo);
+void draw_hand(int *framebuffer, struct fb_var_screeninfo vinfo, angle_t angle, int length, int width, int color);
+void draw_clock_face(int *framebuffer, struct fb_var_screeninfo vinfo, const struct wallpaper *wallpaper);
+void update_time(int *framebuffer, struct fb_var_screeninfo vinfo, const struct sysinfo_snapshot *info, const struct graph *history);
 void draw_text(int *framebuffer, struct fb_var_screeninfo vinfo, const char *text, int x, int y, int size, int color);
-void update_system_info(int *framebuffer, struct fb_var_screeninfo vinfo);
+void sample_system_info(struct sysinfo_snapshot *info);
+void update_system_info(int *framebuffer, struct fb_var_screeninfo vinfo, const struct sysinfo_snapshot *info, const struct graph *history);
 int get_cpu_usage();
 int get_ram_usage();
 int get_disk_usage();
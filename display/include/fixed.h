@@ -0,0 +1,68 @@
+// include/fixed.h
+#ifndef FIXED_H
+#define FIXED_H
+
+#include <stdint.h>
+
+// Q16.16 fixed-point math for FPU-less targets, selected with
+// `make FIXED_POINT=1` (defines FB_FIXED_POINT). Angles are binary angles:
+// a full turn is 2^32, so they wrap for free. The sine and reciprocal tables
+// are generated on the build host by tools/gen_tables.c.
+
+typedef int32_t fixed_t;
+typedef uint32_t fx_angle_t;
+
+#define FX_SHIFT 16
+#define FX_ONE (1 << FX_SHIFT)
+#define FX_SIN_BITS 10      // log2 of sine table entries per quarter turn
+#define FX_RECIP_BITS 11    // Mantissa bits used to index the reciprocal table
+
+#define INT_TO_FX(i) ((fixed_t)((i) * FX_ONE))
+#define FX_TO_INT(f) ((f) >> FX_SHIFT)                                  // Rounds toward -inf
+#define FX_CONST(f) ((fixed_t)((f) * FX_ONE))                           // Compile-time constants only
+#define FX_RAD(r) ((fx_angle_t)(int64_t)((r) * 683565275.57643158))     // 2^32 / (2 * pi)
+
+extern const int32_t fx_sin_table[(1 << FX_SIN_BITS) + 2];
+extern const uint32_t fx_recip_table[1 << FX_RECIP_BITS];
+
+static inline fixed_t fx_mul(fixed_t a, fixed_t b) {
+    return (fixed_t)(((int64_t)a * b) >> FX_SHIFT);
+}
+
+// Truncates toward zero, like an (int) cast of a float
+static inline int fx_trunc(fixed_t f) {
+    return f < 0 ? -(-f >> FX_SHIFT) : f >> FX_SHIFT;
+}
+
+// Angle of num/den degrees
+static inline fx_angle_t fx_deg(int64_t num, int64_t den) {
+    return (fx_angle_t)(num * 4294967296LL / (360 * den));
+}
+
+// Quarter-wave table lookup with linear interpolation between entries
+static inline fixed_t fx_sin(fx_angle_t a) {
+    uint32_t quadrant = a >> 30;
+    uint32_t p = a & 0x3FFFFFFF;
+    if (quadrant & 1) p = 0x40000000 - p;
+    uint32_t index = p >> (30 - FX_SIN_BITS);
+    uint32_t frac = (p >> (30 - FX_SIN_BITS - 16)) & 0xFFFF;
+    fixed_t s0 = fx_sin_table[index];
+    fixed_t s = s0 + (fixed_t)(((int64_t)(fx_sin_table[index + 1] - s0) * frac) >> 16);
+    return quadrant & 2 ? -s : s;
+}
+
+static inline fixed_t fx_cos(fx_angle_t a) {
+    return fx_sin(a + 0x40000000u);
+}
+
+// a / d for d > 0 without a divide: normalise d to its top FX_RECIP_BITS + 1
+// bits and multiply by the table entry 2^(31 + FX_RECIP_BITS) / mantissa
+static inline fixed_t fx_div(fixed_t a, fixed_t d) {
+    int shift = 31 - __builtin_clz((uint32_t)d);
+    uint32_t m = shift >= FX_RECIP_BITS ? (uint32_t)d >> (shift - FX_RECIP_BITS)
+                                        : (uint32_t)d << (FX_RECIP_BITS - shift);
+    int64_t r = fx_recip_table[m - (1u << FX_RECIP_BITS)];
+    return (fixed_t)(((int64_t)a * r) >> (shift + 15));
+}
+
+#endif
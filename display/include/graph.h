@@ -0,0 +1,36 @@
+// include/graph.h
+#ifndef GRAPH_H
+#define GRAPH_H
+
+#include <stdint.h>
+#include <linux/fb.h>
+
+// Scrolling history graph: one column per sample, newest on the right. The
+// samples live in a fixed ring buffer, and the plot is kept drawn in an
+// off-screen strip. A new sample moves each strip row left one pixel with
+// memmove and draws just the new column; no sample is ever re-plotted, so
+// a push is one memmove per row whatever the values were. Each frame
+// blends the strip over the shadow buffer.
+
+struct graph {
+    int width;              // Samples shown, one pixel column each
+    int height;
+    uint32_t color;         // xRGB line colour; the area below is a translucent fill
+    uint8_t *ring;          // Last `width` samples, 0..100
+    int newest;             // Ring index of the latest sample
+    int count;              // Samples held, up to width
+    uint32_t *strip;        // Premultiplied ARGB, width x height
+};
+
+// Returns -1 if the buffers cannot be allocated
+int graph_init(struct graph *graph, int width, int height, uint32_t color);
+void graph_free(struct graph *graph);
+
+// Add a sample (clamped to 0..100) and scroll it in
+void graph_push(struct graph *graph, int value);
+
+// Blend the newest `width` columns of the strip (all of them when it is
+// wider) over a framebuffer with their top-left corner at (x, y)
+void graph_draw(const struct graph *graph, int *framebuffer, struct fb_var_screeninfo vinfo, int x, int y, int width);
+
+#endif
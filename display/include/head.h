@@ -0,0 +1,95 @@
+// include/head.h
+#ifndef HEAD_H
+#define HEAD_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <linux/fb.h>
+#include "graph.h"
+#include "present.h"
+#include "wallpaper.h"
+
+// One framebuffer device ("head") driven by its own render thread. Each head
+// has its own geometry, pixel format and shadow buffer, and paces itself on
+// its own timerfd, so a slow device only drops its own frames. The thread
+// is pinned to one CPU; anything shared between heads (the sysinfo
+// snapshot, the font) is computed once and only read by the head threads.
+//
+// A head may draw at a logical resolution smaller than its panel; the
+// shadow, wallpaper and layout are all at that size, and the frame is
+// scaled up to the device as it is presented.
+//
+// A head may also be rotated (include/rotate.h) for a panel mounted
+// sideways or upside down. Everything is drawn upright, and for 90 and 270
+// the panel counts as yres x xres. The frame is turned as it is presented,
+// before scaling, format conversion and the diff. When none of those apply,
+// it is turned straight into the device.
+
+#define MAX_HEADS 8
+#define HEAD_GRAPHS 4  // CPU, RAM, disk, temperature
+#define HEAD_ACK_TIMEOUT_MS 1000  // Longest wait for a head to stop drawing on a VT switch
+
+struct head;
+typedef void (*head_render_fn)(struct head *head);
+
+struct head {
+    char path[64];
+    int index;
+    int fd;
+    void *device;           // mmap'd framebuffer memory
+    size_t device_size;
+    struct surface_pool *pool;  // Shadow, rotated frame and scaler buffers; main thread only
+    int *shadow;            // 32-bit xRGB, xres_virtual pixels per row
+    struct surface shadow_surface;  // Its pool memory
+    int native;             // Device takes the shadow's pixels as they are
+    struct wallpaper wallpaper;  // Background at this head's resolution; pixels NULL for black
+    struct graph history[HEAD_GRAPHS];  // Stats history, scrolled in by this head's thread
+    unsigned long history_samples;      // Last sample number pushed into the graphs
+    struct fb_var_screeninfo vinfo;         // What is drawn: the logical resolution
+    struct fb_var_screeninfo device_vinfo;  // What the panel is
+    struct fb_fix_screeninfo finfo;
+    int scaled;             // Logical and device resolutions differ
+    struct present_scale scale;
+    struct diff diff;       // Last presented frame at device size; previous NULL when off
+    int rotation;           // 0, 90, 180 or 270 degrees clockwise
+    int *rotated;           // The turned frame, when it is not written straight to the device
+    struct surface rotated_surface;
+    struct fb_var_screeninfo rotated_vinfo;  // Its geometry: the logical frame turned
+    int timer_fd;           // This head's frame timer
+    int wake_fd;            // eventfd: stop/suspend/resume requests from the main thread
+    int ack_fd;             // eventfd: the thread has stopped drawing after a suspend request
+    int running;
+    int suspended;
+    head_render_fn render;
+    pthread_t thread;
+};
+
+// Open, map and allocate a shadow for one device, with buffers from `pool`;
+// returns -1 on error
+int head_open(struct head *head, const char *path, int index, struct surface_pool *pool);
+void head_close(struct head *head);
+// Turn every frame by 0, 90, 180 or 270 degrees as it is presented. Call it
+// before head_set_resolution(), which then takes the upright panel size.
+// Returns -1 on error.
+int head_set_rotation(struct head *head, int rotation);
+// Draw at width x height and scale to the panel when presenting (the
+// default is the panel's own resolution); returns -1 on error
+int head_set_resolution(struct head *head, int width, int height);
+
+// Start the render thread pinned to `cpu`, drawing once per wall-clock second
+int head_start(struct head *head, head_render_fn render, int cpu);
+void head_stop(struct head *head);
+// Stop the frame timer while suspended; a repaint follows on resume.
+// Suspending only asks: head_wait_suspended() returns once the thread has
+// finished the frame it was drawing and will not touch the device again
+// until it is resumed. Ask every head first, then wait for each.
+void head_suspend(struct head *head, int suspended);
+void head_wait_suspended(struct head *head);
+
+// Only write what changed since the last frame (include/diff.h); returns -1 on error
+int head_enable_diff(struct head *head);
+
+// Write the shadow to the device, converting the pixel format if needed
+void head_present(struct head *head);
+
+#endif
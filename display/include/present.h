@@ -0,0 +1,56 @@
+// include/present.h
+#ifndef PRESENT_H
+#define PRESENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/fb.h>
+#include "diff.h"
+#include "surface.h"
+
+// Frames are drawn into a shadow buffer in cached RAM (same layout as the
+// device: xres_virtual pixels per row) and pushed to the mmap'd device here.
+// Every present takes an optional diff (include/diff.h): with one, only the
+// parts of each row that changed since the last frame are written.
+
+// Take a zeroed shadow buffer with the device's layout from the pool. It is
+// one contiguous row, so rows stay xres_virtual pixels apart. Returns its
+// pixels, or NULL; *surface is what goes back to surface_free().
+int *alloc_shadow(struct surface_pool *pool, struct surface *surface, struct fb_var_screeninfo vinfo);
+// Copy with non-temporal stores: write-only, bypasses the cache
+void stream_copy(void *dst, const void *src, size_t bytes);
+// Push the visible rows of the shadow buffer to the device mapping
+void present_frame(int *device, const int *shadow, struct fb_var_screeninfo vinfo, struct diff *diff);
+
+// True when the device is 32-bit xRGB with the shadow's row length, so
+// present_frame() can copy it as is
+int present_is_native(struct fb_var_screeninfo vinfo, struct fb_fix_screeninfo finfo);
+// Pack each visible row into the device's 16/24/32 bpp format and stream it out
+void present_convert(void *device, const int *shadow, struct fb_var_screeninfo vinfo, struct fb_fix_screeninfo finfo,
+                     struct diff *diff);
+
+// Scaling from a logical resolution to the device's. The logical frame is
+// fitted to the panel keeping its aspect ratio, with black bars on the rest.
+// Integer factors replicate pixels with SIMD stores and write each built row
+// `factor` times; any other ratio is bilinear, stretching each source row
+// once and blending row pairs with the blend.h kernels.
+struct present_scale {
+    int src_w, src_h;
+    int out_x, out_y, out_w, out_h; // Where the picture lands on the device
+    int factor;                     // Integer replication factor, 0 for bilinear
+    int *x_index;                   // Bilinear: left source column and 8-bit weight per output column
+    uint8_t *x_frac;
+    uint32_t *rows[2];              // Bilinear: the two latest source rows, stretched to out_w
+    int row_y[2];
+    uint32_t *out_row;              // One device-wide xRGB row
+    uint8_t *packed;                // That row in the device format
+    struct surface buffers;         // One pool block all of the arrays above are carved from
+};
+
+int present_scale_init(struct present_scale *scale, struct surface_pool *pool, struct fb_var_screeninfo logical,
+                       struct fb_var_screeninfo vinfo);
+void present_scale_free(struct present_scale *scale, struct surface_pool *pool);
+void present_scaled(void *device, const int *shadow, struct fb_var_screeninfo logical, struct fb_var_screeninfo vinfo,
+                    struct fb_fix_screeninfo finfo, struct present_scale *scale, struct diff *diff);
+
+#endif
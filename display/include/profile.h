@@ -0,0 +1,114 @@
+// include/profile.h
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include <time.h>
+
+// Frame profiler. Built in with `make PROFILE=1` (defines FB_PROFILE);
+// without it every PROF_* macro compiles to nothing.
+//
+// Each thread accumulates into thread-local counters and publishes them into
+// its own slot of a shared stats file once per frame. The file lives at
+// $FB_PROFILE_FILE or /dev/shm/<name>.prof and can be mmap'd read-only by an
+// external tool while rendering continues. A slot's seq is odd while it is
+// being updated: read seq, copy the slot, and retry if seq changed or is odd.
+
+enum prof_stage {
+    PROF_CLEAR,
+    PROF_TRANSFORM,
+    PROF_RASTERIZE,
+    PROF_TEXT,
+    PROF_SYSINFO,
+    PROF_FLUSH,
+    PROF_STAGE_COUNT
+};
+
+enum prof_counter {
+    PROF_PIXELS,
+    PROF_LINES,
+    PROF_GLYPHS,
+    PROF_BYTES_FLUSHED,
+    PROF_FRAMES_DROPPED,    // Pipeline mode (include/frameq.h): frames skipped by the drop policy
+    PROF_QUEUE_DEPTH,       // Sum of frames waiting behind each presented one; divide by frames
+    PROF_LATENCY_NS,        // Sum of submit-to-device times, likewise per presented frame
+    PROF_COUNTER_COUNT
+};
+
+#define PROF_MAGIC 0x52504246u  // "FBPR"
+#define PROF_VERSION 2         // Bump whenever a stage, counter or slot field is added or moved
+#define PROF_MAX_THREADS 16
+#define PROF_HIST_BUCKETS 32    // Bucket i counts frames taking [2^(i-1), 2^i) microseconds
+
+// All totals are cumulative since start; readers diff two snapshots for rates
+struct prof_slot {
+    uint32_t seq;
+    int32_t tid;
+    uint64_t frames;
+    uint64_t last_frame_ns;
+    uint64_t stage_ns[PROF_STAGE_COUNT];
+    uint64_t stage_calls[PROF_STAGE_COUNT];
+    uint64_t counters[PROF_COUNTER_COUNT];
+    uint64_t frame_hist[PROF_HIST_BUCKETS];
+} __attribute__((aligned(64)));
+
+struct prof_file {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t stage_count;
+    uint32_t counter_count;
+    uint32_t hist_buckets;
+    uint32_t nthreads;      // Slots in use
+    char name[40];
+    struct prof_slot slots[PROF_MAX_THREADS];
+};
+
+#ifdef FB_PROFILE
+
+struct prof_local {
+    struct prof_slot *slot;
+    uint64_t stage_t0[PROF_STAGE_COUNT];
+    struct prof_slot acc;
+};
+
+extern __thread struct prof_local prof_tls;
+
+void prof_init(const char *name);
+void prof_shutdown(void);
+void prof_publish(void);
+void prof_frame_end(uint64_t frame_ns);
+
+static inline uint64_t prof_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);  // vDSO, no syscall
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline void prof_stage_end(int stage) {
+    prof_tls.acc.stage_ns[stage] += prof_now() - prof_tls.stage_t0[stage];
+    prof_tls.acc.stage_calls[stage]++;
+}
+
+#define PROF_INIT(name) prof_init(name)
+#define PROF_SHUTDOWN() prof_shutdown()
+#define PROF_BEGIN(stage) (prof_tls.stage_t0[stage] = prof_now())
+#define PROF_END(stage) prof_stage_end(stage)
+#define PROF_COUNT(counter, n) (prof_tls.acc.counters[counter] += (n))
+#define PROF_FRAME_BEGIN() uint64_t prof_frame_t0 = prof_now()
+#define PROF_FRAME_END() prof_frame_end(prof_now() - prof_frame_t0)
+#define PROF_PUBLISH() prof_publish()
+
+#else
+
+#define PROF_INIT(name) do { } while (0)
+#define PROF_SHUTDOWN() do { } while (0)
+#define PROF_BEGIN(stage) do { } while (0)
+#define PROF_END(stage) do { } while (0)
+#define PROF_COUNT(counter, n) do { } while (0)
+#define PROF_FRAME_BEGIN() do { } while (0)
+#define PROF_FRAME_END() do { } while (0)
+#define PROF_PUBLISH() do { } while (0)
+
+#endif
+
+#endif
@@ -0,0 +1,22 @@
+// include/stroke.h
+#ifndef STROKE_H
+#define STROKE_H
+
+#include <linux/fb.h>
+#include "clock.h"
+
+// Thick strokes are turned into one convex polygon and filled with
+// horizontal spans, so each covered pixel is written exactly once and the
+// cost follows the covered area. Integer-only, so it also suits the
+// fixed-point build.
+
+#define STROKE_SUBPIXEL_BITS 8  // Polygon vertices are in 1/256 pixel units
+#define STROKE_BUTT 0
+#define STROKE_ROUND 1
+
+void fill_span(int *framebuffer, struct fb_var_screeninfo vinfo, int y, int x0, int x1, int color);
+void fill_rect(int *framebuffer, struct fb_var_screeninfo vinfo, int x, int y, int w, int h, int color);
+void fill_convex_polygon(int *framebuffer, struct fb_var_screeninfo vinfo, const Point *points, int count, int color);
+void draw_thick_line(int *framebuffer, struct fb_var_screeninfo vinfo, int x0, int y0, int x1, int y1, int width, int cap, int color);
+
+#endif
@@ -0,0 +1,76 @@
+// include/surface.h
+#ifndef SURFACE_H
+#define SURFACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Off-screen surfaces (back buffers, layer caches, sprite frames) come from
+// a pool of anonymous mappings instead of malloc. Big surfaces are backed by
+// 2 MB pages, from hugetlbfs (MAP_HUGETLB) when asked for and available,
+// otherwise transparent huge pages (madvise MADV_HUGEPAGE) on 2 MB aligned
+// memory. With SURFACE_PREFAULT every page is touched at allocation time, so
+// the first frames do not take a page-fault storm. Freed surfaces keep their
+// memory and are handed out again to a request of the same size class.
+//
+// Rows start on a 64-byte boundary, and strides are padded so they are never a
+// multiple of 4 KB (rows that far apart would land in the same cache sets).
+//
+// A pool is not thread-safe: allocate and free from one thread.
+
+#define SURFACE_HUGE_PAGE (2u << 20)
+#define SURFACE_ALIGN 64
+
+enum {
+    SURFACE_HUGETLB = 1 << 0,   // Try MAP_HUGETLB first (needs vm.nr_hugepages)
+    SURFACE_THP = 1 << 1,       // madvise(MADV_HUGEPAGE) ordinary mappings
+    SURFACE_PREFAULT = 1 << 2,  // Fault every page in up front
+};
+
+struct surface_block {
+    void *mem;
+    size_t bytes;               // Size class: what was actually mapped
+    int backing;                // SURFACE_HUGETLB, SURFACE_THP or 0 (small pages)
+    struct surface_block *next; // Free list link
+};
+
+struct surface {
+    uint8_t *pixels;
+    int width;
+    int height;
+    int bytes_per_pixel;
+    size_t stride;              // Bytes from one row to the next
+    struct surface_block *block;
+};
+
+struct surface_pool {
+    int flags;
+    struct surface_block *free_list;
+    size_t mapped_bytes;        // Everything mapped, in use or free
+    size_t used_bytes;          // Size classes handed out right now
+    size_t peak_bytes;
+    size_t hugetlb_bytes;       // Mapped bytes by backing
+    size_t thp_bytes;
+    unsigned long allocs;
+    unsigned long reuses;       // Allocations served from the free list
+    unsigned long maps;         // Allocations that needed a new mapping
+};
+
+void surface_pool_init(struct surface_pool *pool, int flags);
+// Unmap everything on the free list (surfaces still out are the caller's bug)
+void surface_pool_destroy(struct surface_pool *pool);
+
+// Returns 0 and fills *surface, or -1 if no memory could be mapped. A new
+// mapping is zeroed; a reused block still holds its previous contents.
+int surface_alloc(struct surface_pool *pool, struct surface *surface, int width, int height, int bytes_per_pixel);
+// Return a surface's memory to the pool for reuse
+void surface_free(struct surface_pool *pool, struct surface *surface);
+
+static inline uint8_t *surface_row(const struct surface *surface, int y) {
+    return surface->pixels + (size_t)y * surface->stride;
+}
+
+void surface_pool_report(const struct surface_pool *pool, FILE *out);
+
+#endif
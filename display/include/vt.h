@@ -0,0 +1,27 @@
+// include/vt.h
+#ifndef VT_H
+#define VT_H
+
+#include "evloop.h"
+
+// Virtual terminal switching. With VT_PROCESS mode the kernel asks us
+// (SIGUSR1) before switching away and tells us (SIGUSR2) when our VT is
+// back. While hidden the loop is suspended so nothing is drawn over the
+// active console; on return one full repaint is queued. The change handler
+// is where a program disarms and re-arms its timers. The VT is released as
+// soon as the handler returns, so by then nothing may write to the device.
+
+typedef void (*vt_change_fn)(struct evloop *loop, int visible, void *ctx);
+
+struct vt_state {
+    int fd;         // -1 when not running on a VT (ssh, serial): always visible
+    int visible;
+    vt_change_fn on_change;
+    void *ctx;
+};
+
+int vt_init(struct vt_state *vt, struct evloop *loop, vt_change_fn fn, void *ctx);
+// Hand VT switching back to the kernel
+void vt_restore(struct vt_state *vt);
+
+#endif
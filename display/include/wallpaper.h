@@ -0,0 +1,28 @@
+// include/wallpaper.h
+#ifndef WALLPAPER_H
+#define WALLPAPER_H
+
+#include <stdint.h>
+#include <linux/fb.h>
+
+// Background image behind the clock. The file (binary PPM "P6" or QOI) is
+// decoded once at startup, one source row at a time, and each row is scaled
+// as it arrives into a cached copy at the panel's resolution, already in
+// the shadow buffer's 32-bit xRGB format. No full-size RGBA copy of the
+// source is ever made. Each tick then restores the background with plain
+// row copies instead of clearing to black.
+
+struct wallpaper {
+    uint32_t *pixels;   // width pixels per row
+    int width;
+    int height;
+};
+
+// Decode and scale `path` to width x height; returns -1 on error
+int wallpaper_load(struct wallpaper *wp, const char *path, int width, int height);
+void wallpaper_free(struct wallpaper *wp);
+
+// Copy the cached image over the visible rows of a shadow buffer
+void wallpaper_restore(const struct wallpaper *wp, int *framebuffer, struct fb_var_screeninfo vinfo);
+
+#endif
@@ -0,0 +1,265 @@
+#include "../include/blend.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BLEND_X86 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define BLEND_NEON 1
+#endif
+
+// Scalar reference versions; two channels at a time in 16-bit lanes.
+// (x + 128 + ((x + 128) >> 8)) >> 8 is x / 255 rounded, exact for x <= 255 * 255.
+
+static inline uint32_t over_pixel(uint32_t s, uint32_t d) {
+    uint32_t ia = 255 - (s >> 24);
+    uint32_t rb = (d & 0x00FF00FF) * ia + 0x00800080;
+    uint32_t ag = ((d >> 8) & 0x00FF00FF) * ia + 0x00800080;
+    rb = ((rb + ((rb >> 8) & 0x00FF00FF)) >> 8) & 0x00FF00FF;
+    ag = (ag + ((ag >> 8) & 0x00FF00FF)) & 0xFF00FF00;
+    return s + rb + ag;  // Premultiplied source, so no channel can carry
+}
+
+static inline uint32_t lerp_pixel(uint32_t s, uint32_t d, uint32_t a) {
+    uint32_t ia = 255 - a;
+    uint32_t rb = (s & 0x00FF00FF) * a + (d & 0x00FF00FF) * ia + 0x00800080;
+    uint32_t ag = ((s >> 8) & 0x00FF00FF) * a + ((d >> 8) & 0x00FF00FF) * ia + 0x00800080;
+    rb = ((rb + ((rb >> 8) & 0x00FF00FF)) >> 8) & 0x00FF00FF;
+    ag = (ag + ((ag >> 8) & 0x00FF00FF)) & 0xFF00FF00;
+    return rb | ag;
+}
+
+#ifdef BLEND_X86
+
+static int have_avx2(void) {
+    static int cached = -1;
+    if (cached < 0) {
+        __builtin_cpu_init();
+        cached = __builtin_cpu_supports("avx2") ? 1 : 0;
+    }
+    return cached;
+}
+
+// SSE2: 4 pixels per step, unpacked to 16-bit lanes
+static inline __m128i div255_sse2(__m128i x) {
+    x = _mm_add_epi16(x, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+static inline __m128i over4_sse2(__m128i s, __m128i d) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ff = _mm_set1_epi16(255);
+    __m128i slo = _mm_unpacklo_epi8(s, zero);
+    __m128i shi = _mm_unpackhi_epi8(s, zero);
+    // Broadcast each pixel's alpha (lane 3 / lane 7) across its four channels
+    __m128i ialo = _mm_sub_epi16(ff, _mm_shufflehi_epi16(_mm_shufflelo_epi16(slo, 0xFF), 0xFF));
+    __m128i iahi = _mm_sub_epi16(ff, _mm_shufflehi_epi16(_mm_shufflelo_epi16(shi, 0xFF), 0xFF));
+    __m128i dlo = div255_sse2(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), ialo));
+    __m128i dhi = div255_sse2(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), iahi));
+    return _mm_adds_epu8(s, _mm_packus_epi16(dlo, dhi));
+}
+
+static inline __m128i lerp4_sse2(__m128i s, __m128i d, __m128i a, __m128i ia) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(s, zero), a),
+                               _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), ia));
+    __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(s, zero), a),
+                               _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), ia));
+    return _mm_packus_epi16(div255_sse2(lo), div255_sse2(hi));
+}
+
+static int over_span_sse2(uint32_t *dst, const uint32_t *src, int count) {
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+        _mm_storeu_si128((__m128i *)(dst + i), over4_sse2(s, d));
+    }
+    return i;
+}
+
+static int lerp_span_sse2(uint32_t *dst, const uint32_t *src, uint32_t color, int alpha, int count) {
+    __m128i a = _mm_set1_epi16(alpha);
+    __m128i ia = _mm_set1_epi16(255 - alpha);
+    __m128i c = _mm_set1_epi32(color);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i s = src ? _mm_loadu_si128((const __m128i *)(src + i)) : c;
+        __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+        _mm_storeu_si128((__m128i *)(dst + i), lerp4_sse2(s, d, a, ia));
+    }
+    return i;
+}
+
+// AVX2: same kernels, 8 pixels per step. Unpack and pack both work within
+// 128-bit lanes, so pixel order is preserved without any permutes.
+__attribute__((target("avx2")))
+static inline __m256i div255_avx2(__m256i x) {
+    x = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+}
+
+__attribute__((target("avx2")))
+static int over_span_avx2(uint32_t *dst, const uint32_t *src, int count) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ff = _mm256_set1_epi16(255);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+        __m256i slo = _mm256_unpacklo_epi8(s, zero);
+        __m256i shi = _mm256_unpackhi_epi8(s, zero);
+        __m256i ialo = _mm256_sub_epi16(ff, _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(slo, 0xFF), 0xFF));
+        __m256i iahi = _mm256_sub_epi16(ff, _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(shi, 0xFF), 0xFF));
+        __m256i dlo = div255_avx2(_mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), ialo));
+        __m256i dhi = div255_avx2(_mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), iahi));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_adds_epu8(s, _mm256_packus_epi16(dlo, dhi)));
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static int lerp_span_avx2(uint32_t *dst, const uint32_t *src, uint32_t color, int alpha, int count) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i a = _mm256_set1_epi16(alpha);
+    __m256i ia = _mm256_set1_epi16(255 - alpha);
+    __m256i c = _mm256_set1_epi32(color);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i s = src ? _mm256_loadu_si256((const __m256i *)(src + i)) : c;
+        __m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+        __m256i lo = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(s, zero), a),
+                                      _mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), ia));
+        __m256i hi = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(s, zero), a),
+                                      _mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), ia));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_packus_epi16(div255_avx2(lo), div255_avx2(hi)));
+    }
+    return i;
+}
+
+static int over_span_simd(uint32_t *dst, const uint32_t *src, int count) {
+    return have_avx2() ? over_span_avx2(dst, src, count) : over_span_sse2(dst, src, count);
+}
+
+static int lerp_span_simd(uint32_t *dst, const uint32_t *src, uint32_t color, int alpha, int count) {
+    return have_avx2() ? lerp_span_avx2(dst, src, color, alpha, count)
+                       : lerp_span_sse2(dst, src, color, alpha, count);
+}
+
+#elif defined(BLEND_NEON)
+
+// NEON: 8 pixels per step, de-interleaved into B, G, R, A planes by vld4
+static inline uint8x8_t div255_neon(uint16x8_t x) {
+    return vrshrn_n_u16(vrsraq_n_u16(x, x, 8), 8);
+}
+
+static int over_span_simd(uint32_t *dst, const uint32_t *src, int count) {
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        uint8x8x4_t s = vld4_u8((const uint8_t *)(src + i));
+        uint8x8x4_t d = vld4_u8((const uint8_t *)(dst + i));
+        uint8x8_t ia = vmvn_u8(s.val[3]);
+        for (int c = 0; c < 4; c++) {
+            d.val[c] = vqadd_u8(s.val[c], div255_neon(vmull_u8(d.val[c], ia)));
+        }
+        vst4_u8((uint8_t *)(dst + i), d);
+    }
+    return i;
+}
+
+static int lerp_span_simd(uint32_t *dst, const uint32_t *src, uint32_t color, int alpha, int count) {
+    uint8x8_t a = vdup_n_u8(alpha);
+    uint8x8_t ia = vdup_n_u8(255 - alpha);
+    uint8x8x4_t c;
+    for (int k = 0; k < 4; k++) c.val[k] = vdup_n_u8((color >> (8 * k)) & 0xFF);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        uint8x8x4_t s = src ? vld4_u8((const uint8_t *)(src + i)) : c;
+        uint8x8x4_t d = vld4_u8((const uint8_t *)(dst + i));
+        for (int k = 0; k < 4; k++) {
+            d.val[k] = div255_neon(vmlal_u8(vmull_u8(s.val[k], a), d.val[k], ia));
+        }
+        vst4_u8((uint8_t *)(dst + i), d);
+    }
+    return i;
+}
+
+#else
+
+static int over_span_simd(uint32_t *dst, const uint32_t *src, int count) {
+    return 0;
+}
+
+static int lerp_span_simd(uint32_t *dst, const uint32_t *src, uint32_t color, int alpha, int count) {
+    return 0;
+}
+
+#endif
+
+// Each span runs the widest available kernel, then finishes the tail in scalar code
+void blend_over_span(uint32_t *dst, const uint32_t *src, int count) {
+    for (int i = over_span_simd(dst, src, count); i < count; i++) {
+        dst[i] = over_pixel(src[i], dst[i]);
+    }
+}
+
+void blend_fill_span(uint32_t *dst, uint32_t color, int alpha, int count) {
+    if (alpha <= 0) return;
+    if (alpha >= 255) {
+        for (int i = 0; i < count; i++) dst[i] = color;
+        return;
+    }
+    for (int i = lerp_span_simd(dst, NULL, color, alpha, count); i < count; i++) {
+        dst[i] = lerp_pixel(color, dst[i], alpha);
+    }
+}
+
+void blend_blit_span(uint32_t *dst, const uint32_t *src, int alpha, int count) {
+    if (alpha <= 0) return;
+    if (alpha >= 255) {
+        for (int i = 0; i < count; i++) dst[i] = src[i];
+        return;
+    }
+    for (int i = lerp_span_simd(dst, src, 0, alpha, count); i < count; i++) {
+        dst[i] = lerp_pixel(src[i], dst[i], alpha);
+    }
+}
+
+// Clip a rectangle against the framebuffer; returns 0 if nothing is left.
+// src_x/src_y receive how far the rectangle's origin moved.
+static int clip_rect(struct fb_var_screeninfo vinfo, int *x, int *y, int *w, int *h, int *src_x, int *src_y) {
+    *src_x = *x < 0 ? -*x : 0;
+    *src_y = *y < 0 ? -*y : 0;
+    *x += *src_x; *w -= *src_x;
+    *y += *src_y; *h -= *src_y;
+    if (*x + *w > (int)vinfo.xres_virtual) *w = vinfo.xres_virtual - *x;
+    if (*y + *h > (int)vinfo.yres_virtual) *h = vinfo.yres_virtual - *y;
+    return *w > 0 && *h > 0;
+}
+
+void blend_fill_rect(int *framebuffer, struct fb_var_screeninfo vinfo, int x, int y, int w, int h, int color, int alpha) {
+    int sx, sy;
+    if (!clip_rect(vinfo, &x, &y, &w, &h, &sx, &sy)) return;
+    for (int row = 0; row < h; row++) {
+        uint32_t *dst = (uint32_t *)framebuffer + (size_t)(y + row) * vinfo.xres_virtual + x;
+        blend_fill_span(dst, (uint32_t)color, alpha, w);
+    }
+}
+
+void blend_over_rect(int *framebuffer, struct fb_var_screeninfo vinfo, const uint32_t *src, int src_stride, int x, int y, int w, int h) {
+    int sx, sy;
+    if (!clip_rect(vinfo, &x, &y, &w, &h, &sx, &sy)) return;
+    for (int row = 0; row < h; row++) {
+        uint32_t *dst = (uint32_t *)framebuffer + (size_t)(y + row) * vinfo.xres_virtual + x;
+        blend_over_span(dst, src + (size_t)(sy + row) * src_stride + sx, w);
+    }
+}
+
+void blend_blit_rect(int *framebuffer, struct fb_var_screeninfo vinfo, const uint32_t *src, int src_stride, int x, int y, int w, int h, int alpha) {
+    int sx, sy;
+    if (!clip_rect(vinfo, &x, &y, &w, &h, &sx, &sy)) return;
+    for (int row = 0; row < h; row++) {
+        uint32_t *dst = (uint32_t *)framebuffer + (size_t)(y + row) * vinfo.xres_virtual + x;
+        blend_blit_span(dst, src + (size_t)(sy + row) * src_stride + sx, alpha, w);
+    }
+}
@@ -1,4 +1,12 @@
 #include "../include/clock.h"
+#include "../include/profile.h"
+#include "../include/blend.h"
+#include "../include/present.h"
+#include "../include/stroke.h"
+#include "../include/evloop.h"
+#include "../include/vt.h"
+#include "../include/head.h"
+#include "../include/rotate.h"
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
@@ -14,6 +22,7 @@
 void set_pixel(int *framebuffer, struct fb_var_screeninfo vinfo, int x, int y, int color) {
     if (x >= 0 && x < vinfo.xres_virtual && y >= 0 && y < vinfo.yres_virtual) {
         framebuffer[y * vinfo.xres_virtual + x] = color;
+        PROF_COUNT(PROF_PIXELS, 1);
     }
 }
 
@@ -23,6 +32,7 @@ void draw_line(int *framebuffer, struct fb_var_screeninfo vinfo, int x0, int y0,
     int dy = -abs(y1 - y0), sy = y0 < y1 ? 1 : -1;
     int err = dx + dy, e2;
 
+    PROF_COUNT(PROF_LINES, 1);
     while (1) {
         set_pixel(framebuffer, vinfo, x0, y0, color);
         if (x0 == x1 && y0 == y1) break;
@@ -48,6 +58,7 @@ void draw_char(int *framebuffer, struct fb_var_screeninfo vinfo, char c, int x,
     };
 
     if (c >= '0' && c <= '9') {
+        PROF_COUNT(PROF_GLYPHS, 1);
         int index = c - '0';
         for (int row = 0; row < 5; ++row) {
             for (int col = 0; col < 3; ++col) {
@@ -74,9 +85,15 @@ void draw_text(int *framebuffer, struct fb_var_screeninfo vinfo, const char *tex
 // Draw numbers around the clock face
 void draw_circle(int *framebuffer, struct fb_var_screeninfo vinfo) {
     for (int i = 1; i <= 12; ++i) {
+#ifdef FB_FIXED_POINT
+        fx_angle_t angle = fx_deg(i * 30 - 90, 1);
+        int x = CENTER_X + fx_trunc(RADIUS * fx_cos(angle));
+        int y = CENTER_Y + fx_trunc(RADIUS * fx_sin(angle));
+#else
         float angle = (i * 30 - 90) * M_PI / 180.0;
         int x = CENTER_X + (int)(RADIUS * cos(angle));
         int y = CENTER_Y + (int)(RADIUS * sin(angle));
+#endif
         
         char buffer[3];
         sprintf(buffer, "%d", i);
@@ -84,17 +101,32 @@ void draw_circle(int *framebuffer, struct fb_var_screeninfo vinfo) {
     }
 }
 
-// Draw clock hands
-void draw_hand(int *framebuffer, struct fb_var_screeninfo vinfo, float angle, int length, int color) {
+// Draw clock hands as thick round-capped strokes
+void draw_hand(int *framebuffer, struct fb_var_screeninfo vinfo, angle_t angle, int length, int width, int color) {
+#ifdef FB_FIXED_POINT
+    int x_end = CENTER_X + FX_TO_INT(length * fx_cos(angle));
+    int y_end = CENTER_Y + FX_TO_INT(-length * fx_sin(angle));
+#else
     int x_end = CENTER_X + length * cos(angle);
     int y_end = CENTER_Y - length * sin(angle);
-    draw_line(framebuffer, vinfo, CENTER_X, CENTER_Y, x_end, y_end, color);
+#endif
+    draw_thick_line(framebuffer, vinfo, CENTER_X, CENTER_Y, x_end, y_end, width, STROKE_ROUND, color);
 }
 
-// Draw the clock face with numbers
-void draw_clock_face(int *framebuffer, struct fb_var_screeninfo vinfo) {
-    memset(framebuffer, 0, vinfo.yres_virtual * vinfo.xres_virtual * sizeof(int)); // Clear screen
+// Draw the clock face with numbers over the wallpaper, or black without one
+void draw_clock_face(int *framebuffer, struct fb_var_screeninfo vinfo, const struct wallpaper *wallpaper) {
+    PROF_BEGIN(PROF_CLEAR);
+    if (wallpaper->pixels != NULL) {
+        wallpaper_restore(wallpaper, framebuffer, vinfo);
+    } else {
+        memset(framebuffer, 0, vinfo.yres_virtual * vinfo.xres_virtual * sizeof(int)); // Clear screen
+        PROF_COUNT(PROF_PIXELS, vinfo.yres_virtual * vinfo.xres_virtual);
+    }
+    PROF_END(PROF_CLEAR);
+
+    PROF_BEGIN(PROF_TEXT);
     draw_circle(framebuffer, vinfo); // Draw the numbers
+    PROF_END(PROF_TEXT);
 }
 
 // Function to read the first line of a file
@@ -164,107 +196,344 @@ int get_cpu_temperature() {
     return atoi(buffer) / 1000;
 }
 
-// Draw a percentage bar using [#####] style
+// Draw a filled percentage bar followed by the dimmed rest of its track, five glyphs wide
 void draw_percentage_bar(int *framebuffer, struct fb_var_screeninfo vinfo, int x, int y, int percentage, int size, int color) {
-    char bar[6];
-    int num_hashes = (percentage / 20);
-    for (int i = 0; i < 5; ++i) {
-        bar[i] = i < num_hashes ? '#' : ' ';
-    }
-    bar[5] = '\0';
-    draw_text(framebuffer, vinfo, bar, x, y, size, color);
+    int width = 5 * size * 4;
+    int height = 5 * size;
+    if (percentage < 0) percentage = 0;
+    if (percentage > 100) percentage = 100;
+    int filled = width * percentage / 100;
+    fill_rect(framebuffer, vinfo, x, y, filled, height, color);
+    blend_fill_rect(framebuffer, vinfo, x + filled, y, width - filled, height, color, 48);
 }
 
-// Update system info on the screen
-void update_system_info(int *framebuffer, struct fb_var_screeninfo vinfo) {
-    int battery_percentage = get_battery_percentage();
-    int cpu_usage = get_cpu_usage();
-    int ram_usage = get_ram_usage();
-    int disk_usage = get_disk_usage();
-    int cpu_temp = get_cpu_temperature();
+// Read all the stats; get_cpu_usage() keeps state, so only one thread may call this
+void sample_system_info(struct sysinfo_snapshot *info) {
+    static unsigned long samples = 0;
+    info->samples = ++samples;
+    info->battery = get_battery_percentage();
+    info->cpu = get_cpu_usage();
+    info->ram = get_ram_usage();
+    info->disk = get_disk_usage();
+    info->cpu_temp = get_cpu_temperature();
+}
+
+// Update system info on the screen; history holds the CPU, RAM, disk and
+// temperature graphs, drawn beside their readings
+void update_system_info(int *framebuffer, struct fb_var_screeninfo vinfo, const struct sysinfo_snapshot *info, const struct graph *history) {
+    int battery_percentage = info->battery;
+    int cpu_usage = info->cpu;
+    int ram_usage = info->ram;
+    int disk_usage = info->disk;
+    int cpu_temp = info->cpu_temp;
 
     char buffer[80];
 
+    // Translucent panel behind the stats so they stay readable over busy
+    // content; rows are 40 px apart from 10 px inside its top-left corner
+    struct stats_box box = layout_stats(vinfo);
+    blend_fill_rect(framebuffer, vinfo, box.x, box.y, box.w, box.h, 0x102030, 160);
+    int left = box.x + 10, top = box.y + 10;
+    int right = left + STATS_LABELS;              // Bars and graphs
+    int graph_w = box.x + box.w - 10 - right;     // Newest samples that fit the panel
+
     // Draw battery info
     sprintf(buffer, "Battery: %d%%", battery_percentage);
-    draw_text(framebuffer, vinfo, buffer, CENTER_X - 100, CENTER_Y + 300, 2, 0xFFFFFF);
-    draw_percentage_bar(framebuffer, vinfo, CENTER_X + 60, CENTER_Y + 300, battery_percentage, 2, 0xFFFFFF);
+    draw_text(framebuffer, vinfo, buffer, left, top, 2, 0xFFFFFF);
+    draw_percentage_bar(framebuffer, vinfo, right, top, battery_percentage, 2, 0xFFFFFF);
 
     // Draw CPU usage
-    sprintf(buffer, "CPU: %d%% Temp: %d°C", cpu_usage, cpu_temp);
-    draw_text(framebuffer, vinfo, buffer, CENTER_X - 100, CENTER_Y + 350, 2, 0xFFFFFF);
-    draw_percentage_bar(framebuffer, vinfo, CENTER_X + 60, CENTER_Y + 350, cpu_usage, 2, 0xFFFFFF);
+    sprintf(buffer, "CPU: %d%%", cpu_usage);
+    draw_text(framebuffer, vinfo, buffer, left, top + 40, 2, 0xFFFFFF);
+    graph_draw(&history[0], framebuffer, vinfo, right, top + 32, graph_w);
 
     // Draw RAM usage
     sprintf(buffer, "RAM: %d%%", ram_usage);
-    draw_text(framebuffer, vinfo, buffer, CENTER_X - 100, CENTER_Y + 400, 2, 0xFFFFFF);
-    draw_percentage_bar(framebuffer, vinfo, CENTER_X + 60, CENTER_Y + 400, ram_usage, 2, 0xFFFFFF);
+    draw_text(framebuffer, vinfo, buffer, left, top + 80, 2, 0xFFFFFF);
+    graph_draw(&history[1], framebuffer, vinfo, right, top + 72, graph_w);
 
     // Draw Disk usage
     sprintf(buffer, "Disk: %d%%", disk_usage);
-    draw_text(framebuffer, vinfo, buffer, CENTER_X - 100, CENTER_Y + 450, 2, 0xFFFFFF);
-    draw_percentage_bar(framebuffer, vinfo, CENTER_X + 60, CENTER_Y + 450, disk_usage, 2, 0xFFFFFF);
+    draw_text(framebuffer, vinfo, buffer, left, top + 120, 2, 0xFFFFFF);
+    graph_draw(&history[2], framebuffer, vinfo, right, top + 112, graph_w);
+
+    // Draw CPU temperature, graphed on a 0-100°C scale
+    sprintf(buffer, "Temp: %d°C", cpu_temp);
+    draw_text(framebuffer, vinfo, buffer, left, top + 160, 2, 0xFFFFFF);
+    graph_draw(&history[3], framebuffer, vinfo, right, top + 152, graph_w);
 }
 
 // Update the clock hands and date/time display
-void update_time(int *framebuffer, struct fb_var_screeninfo vinfo) {
+void update_time(int *framebuffer, struct fb_var_screeninfo vinfo, const struct sysinfo_snapshot *info, const struct graph *history) {
     time_t rawtime;
+    struct tm tm_buf;
     struct tm *timeinfo;
     char date_buffer[80];
     char time_buffer[80];
 
     time(&rawtime);
-    timeinfo = localtime(&rawtime);
+    timeinfo = localtime_r(&rawtime, &tm_buf);  // Every head thread calls this
 
+#ifdef FB_FIXED_POINT
+    // Same angles as below, counted in half degrees
+    angle_t hour_angle = fx_deg(180 - (60 * timeinfo->tm_hour + timeinfo->tm_min), 2);
+    angle_t minute_angle = fx_deg(90 - 6 * timeinfo->tm_min, 1);
+#else
     float hour_angle_degrees = (30 * timeinfo->tm_hour) + (timeinfo->tm_min * 0.5);
     float hour_angle = - hour_angle_degrees * M_PI / 180.0 + M_PI / 2;
 
     float minute_angle_degrees = 6 * timeinfo->tm_min;
     float minute_angle = - minute_angle_degrees * M_PI / 180.0 + M_PI / 2;
+#endif
 
-    draw_hand(framebuffer, vinfo, hour_angle, HOUR_HAND_LENGTH, 0xFFFFFF);
-    draw_hand(framebuffer, vinfo, minute_angle, MINUTE_HAND_LENGTH, 0xFFFFFF);
+    PROF_BEGIN(PROF_RASTERIZE);
+    draw_hand(framebuffer, vinfo, hour_angle, HOUR_HAND_LENGTH, HOUR_HAND_WIDTH, 0xFFFFFF);
+    draw_hand(framebuffer, vinfo, minute_angle, MINUTE_HAND_LENGTH, MINUTE_HAND_WIDTH, 0xFFFFFF);
+    PROF_END(PROF_RASTERIZE);
 
+    PROF_BEGIN(PROF_TEXT);
     strftime(date_buffer, sizeof(date_buffer), "%Y-%m-%d", timeinfo);
     draw_text(framebuffer, vinfo, date_buffer, CENTER_X - 100, CENTER_Y + 200, 3, 0xFFFFFF);
 
     strftime(time_buffer, sizeof(time_buffer), "%H:%M:%S", timeinfo);
     draw_text(framebuffer, vinfo, time_buffer, CENTER_X - 80, CENTER_Y + 250, 3, 0xFFFFFF);
+    PROF_END(PROF_TEXT);
+
+    PROF_BEGIN(PROF_SYSINFO);
+    update_system_info(framebuffer, vinfo, info, history);
+    PROF_END(PROF_SYSINFO);
+}
+
+// Sampled by the main thread once a second and read by every head. seq is
+// odd while an update is in progress; readers retry until they see the same
+// even value before and after copying.
+static struct {
+    uint32_t seq;
+    struct sysinfo_snapshot info;
+} shared_sysinfo;
+
+static void publish_system_info(const struct sysinfo_snapshot *info) {
+    uint32_t seq = shared_sysinfo.seq;
+    __atomic_store_n(&shared_sysinfo.seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(&shared_sysinfo.info, info, sizeof(*info));
+    __atomic_store_n(&shared_sysinfo.seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+static void read_system_info(struct sysinfo_snapshot *info) {
+    uint32_t seq;
+    do {
+        seq = __atomic_load_n(&shared_sysinfo.seq, __ATOMIC_ACQUIRE);
+        memcpy(info, &shared_sysinfo.info, sizeof(*info));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != __atomic_load_n(&shared_sysinfo.seq, __ATOMIC_RELAXED));
+}
+
+// Scroll readings this head has not seen yet into its graphs. Seconds
+// missed while suspended repeat the current reading.
+static void record_history(struct head *head, const struct sysinfo_snapshot *info) {
+    unsigned long missed = head->history_samples == 0 ? 1 : info->samples - head->history_samples;
+    if (missed > HISTORY_WIDTH) missed = HISTORY_WIDTH;
+    int values[HEAD_GRAPHS] = { info->cpu, info->ram, info->disk, info->cpu_temp };
+    for (unsigned long n = 0; n < missed; n++) {
+        for (int i = 0; i < HEAD_GRAPHS; i++) {
+            graph_push(&head->history[i], values[i]);
+        }
+    }
+    head->history_samples = info->samples;
+}
+
+// Draw the whole face into a head's shadow buffer and present it (head thread)
+void render_head(struct head *head) {
+    struct sysinfo_snapshot info;
+    read_system_info(&info);
+
+    PROF_FRAME_BEGIN();
+    record_history(head, &info);
+    draw_clock_face(head->shadow, head->vinfo, &head->wallpaper);
+    update_time(head->shadow, head->vinfo, &info, head->history);
+    head_present(head);
+    PROF_FRAME_END();
+}
+
+// Everything the main thread's event handlers need
+struct display_state {
+    struct head heads[MAX_HEADS];
+    int nheads;
+    int sample_timer;
+};
+
+// Main thread: take this second's stats for all heads
+void sample_frame(void *ctx) {
+    struct sysinfo_snapshot info;
+    sample_system_info(&info);
+    publish_system_info(&info);
+}
+
+// Once per second, on the second
+void on_sample_tick(struct evloop *loop, uint64_t expirations, void *ctx) {
+    loop->dirty = 1;
+}
 
-    update_system_info(framebuffer, vinfo);
+void on_key(struct evloop *loop, int key, void *ctx) {
+    if (key == KEY_Q || key == KEY_ESC) loop->running = 0;
 }
 
-int main() {
-    int fbfd = open("/dev/fb0", O_RDWR);
-    if (fbfd == -1) {
-        perror("Error: cannot open framebuffer device");
-        exit(1);
+// No ticks at all on any head while another VT is in front; every face is
+// repainted on return. Switching away waits until every head has stopped
+// writing to its device, since the VT is released as soon as this returns.
+void on_vt_change(struct evloop *loop, int visible, void *ctx) {
+    struct display_state *state = ctx;
+    evloop_set_timer(loop, state->sample_timer, visible ? 1000000000L : 0);
+    for (int i = 0; i < state->nheads; i++) {
+        head_suspend(&state->heads[i], !visible);
     }
+    for (int i = 0; !visible && i < state->nheads; i++) {
+        head_wait_suspended(&state->heads[i]);
+    }
+}
+
+// Logical resolution for a panel: the largest whole fraction of it that is
+// still at least the 800x600 design size
+static void default_resolution(struct fb_var_screeninfo vinfo, int *width, int *height) {
+    int k = vinfo.xres / SCREEN_WIDTH;
+    if (vinfo.yres / SCREEN_HEIGHT < k) k = vinfo.yres / SCREEN_HEIGHT;
+    if (k < 1) k = 1;
+    *width = vinfo.xres / k;
+    *height = vinfo.yres / k;
+}
 
-    struct fb_var_screeninfo vinfo;
-    if (ioctl(fbfd, FBIOGET_VSCREENINFO, &vinfo)) {
-        perror("Error reading variable information");
-        close(fbfd);
-        exit(2);
+// Usage: clock [-a] [-d] [-w image] [-r WxH] [-R degrees] [device...]
+// Drives every device given, or all /dev/fbN with -a, or $FRAMEBUFFER,
+// falling back to /dev/fb0. -w puts a PPM or QOI image behind the clock.
+// -r draws at WxH on every head and scales it to the panel. -d writes only
+// the pixels that changed since the last frame to each device. -R turns
+// the picture clockwise by 90, 180 or 270 degrees for a rotated panel.
+int main(int argc, char *argv[]) {
+    struct display_state state = { .nheads = 0 };
+    char paths[MAX_HEADS][64];
+    int npaths = 0;
+    const char *wallpaper = NULL;
+    int logical_w = 0, logical_h = 0;
+    int diff_flush = 0;
+    int rotation = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "adw:r:R:")) != -1) {
+        switch (opt) {
+            case 'a':
+                for (int i = 0; i < 32 && npaths < MAX_HEADS; i++) {
+                    snprintf(paths[npaths], sizeof(paths[npaths]), "/dev/fb%d", i);
+                    if (access(paths[npaths], R_OK | W_OK) == 0) npaths++;
+                }
+                break;
+            case 'd':
+                diff_flush = 1;
+                break;
+            case 'w':
+                wallpaper = optarg;
+                break;
+            case 'r':
+                if (sscanf(optarg, "%dx%d", &logical_w, &logical_h) != 2 || logical_w <= 0 || logical_h <= 0) {
+                    fprintf(stderr, "Error: bad resolution '%s'\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'R':
+                rotation = rotate_parse(optarg);
+                if (rotation < 0) {
+                    fprintf(stderr, "Error: bad rotation '%s' (0, 90, 180 or 270)\n", optarg);
+                    exit(1);
+                }
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-a] [-d] [-w image] [-r WxH] [-R degrees] [device...]\n", argv[0]);
+                exit(1);
+        }
+    }
+    for (int i = optind; i < argc && npaths < MAX_HEADS; i++) {
+        snprintf(paths[npaths++], sizeof(paths[0]), "%s", argv[i]);
+    }
+    if (npaths == 0) {
+        const char *env = getenv("FRAMEBUFFER");
+        snprintf(paths[npaths++], sizeof(paths[0]), "%s", env != NULL ? env : "/dev/fb0");
     }
 
-    size_t screensize = vinfo.yres_virtual * vinfo.xres_virtual * vinfo.bits_per_pixel / 8;
-    int *framebuffer = (int *)mmap(0, screensize, PROT_READ | PROT_WRITE, MAP_SHARED, fbfd, 0);
-    if (framebuffer == MAP_FAILED) {
-        perror("Error mapping framebuffer device to memory");
-        close(fbfd);
-        exit(3);
+    // Shadows, rotated frames and scaler rows for every head; all allocated
+    // and freed here on the main thread
+    struct surface_pool pool;
+    surface_pool_init(&pool, SURFACE_THP | SURFACE_PREFAULT);
+    for (int i = 0; i < npaths; i++) {
+        struct head *head = &state.heads[state.nheads];
+        if (head_open(head, paths[i], state.nheads, &pool) != 0) continue;
+        if (head_set_rotation(head, rotation) != 0) {
+            head_close(head);
+            continue;
+        }
+        int w = logical_w, h = logical_h;
+        if (w == 0) default_resolution(head->vinfo, &w, &h);  // The upright panel
+        if (head_set_resolution(head, w, h) != 0 || (diff_flush && head_enable_diff(head) != 0)) {
+            head_close(head);
+            continue;
+        }
+        state.nheads++;
     }
+    if (state.nheads == 0) exit(1);
 
-    while (1) {
-        draw_clock_face(framebuffer, vinfo);
-        update_time(framebuffer, vinfo);
-        sleep(1); 
+    // Scaled once per head; without it (or if it fails to load) the face is drawn on black
+    for (int i = 0; wallpaper != NULL && i < state.nheads; i++) {
+        struct head *head = &state.heads[i];
+        wallpaper_load(&head->wallpaper, wallpaper, head->vinfo.xres, head->vinfo.yres);
+    }
+
+    // CPU, RAM, disk and temperature history, in the order update_system_info() draws them
+    static const uint32_t history_colors[HEAD_GRAPHS] = { 0x4FC3F7, 0x81C784, 0xFFB74D, 0xE57373 };
+    for (int i = 0; i < state.nheads; i++) {
+        for (int g = 0; g < HEAD_GRAPHS; g++) {
+            if (graph_init(&state.heads[i].history[g], HISTORY_WIDTH, HISTORY_HEIGHT, history_colors[g]) != 0) {
+                perror("Error allocating history graphs");
+                exit(1);
+            }
+        }
     }
 
-    munmap(framebuffer, screensize);
-    close(fbfd);
+    PROF_INIT("display");
+
+    // Signals are routed to the loop before any render thread exists
+    struct evloop loop;
+    if (evloop_init(&loop) != 0) exit(5);
+    state.sample_timer = evloop_add_timer(&loop, 1000000000L, 1, on_sample_tick, &state);
+    if (state.sample_timer < 0) exit(5);
+    evloop_add_input(&loop, on_key, &state);
+    struct vt_state vt;
+    vt_init(&vt, &loop, on_vt_change, &state);  // Not on a VT: just always draw
+
+    struct sysinfo_snapshot info;
+    sample_system_info(&info);
+    publish_system_info(&info);
+
+    // One pinned render thread per head, spread over the CPUs
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpu < 1) ncpu = 1;
+    int started = 0;
+    for (; started < state.nheads; started++) {
+        if (head_start(&state.heads[started], render_head, started % ncpu) != 0) break;
+    }
+
+    // Returns on q/Esc or SIGINT/SIGTERM/SIGHUP, so the cleanup below runs
+    if (started == state.nheads) evloop_run(&loop, sample_frame, &state);
+    for (int i = 0; i < started; i++) {
+        head_stop(&state.heads[i]);
+    }
+    vt_restore(&vt);
+    evloop_close(&loop);
+
+    PROF_SHUTDOWN();
+    for (int i = 0; i < state.nheads; i++) {
+        head_close(&state.heads[i]);
+    }
+    surface_pool_report(&pool, stderr);
+    surface_pool_destroy(&pool);
 
     return 0;
 }
-
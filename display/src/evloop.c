@@ -0,0 +1,331 @@
+#include "../include/evloop.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+
+enum { SOURCE_TIMER, SOURCE_EVDEV, SOURCE_FIFO, SOURCE_SIGNAL };
+
+#define BITS_PER_LONG (sizeof(long) * 8)
+#define TEST_BIT(bit, array) ((array[(bit) / BITS_PER_LONG] >> ((bit) % BITS_PER_LONG)) & 1)
+
+static int add_source(struct evloop *loop, int fd, int kind) {
+    if (loop->nsources == EVLOOP_MAX_SOURCES) {
+        fprintf(stderr, "Error: too many event sources\n");
+        close(fd);
+        return -1;
+    }
+    int index = loop->nsources++;
+    memset(&loop->sources[index], 0, sizeof(loop->sources[index]));
+    loop->sources[index].fd = fd;
+    loop->sources[index].kind = kind;
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.u32 = index };
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        perror("Error adding event source");
+        close(fd);
+        loop->nsources--;
+        return -1;
+    }
+    return index;
+}
+
+static void remove_source(struct evloop *loop, int index) {
+    struct evloop_source *src = &loop->sources[index];
+    if (src->fd < 0) return;
+    epoll_ctl(loop->epfd, EPOLL_CTL_DEL, src->fd, NULL);
+    close(src->fd);
+    src->fd = -1;
+}
+
+int evloop_init(struct evloop *loop) {
+    memset(loop, 0, sizeof(*loop));
+    loop->dirty = 1;  // First frame
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epfd == -1) {
+        perror("Error creating epoll instance");
+        return -1;
+    }
+
+    // Termination signals are read from a signalfd like everything else
+    sigemptyset(&loop->sigmask);
+    sigaddset(&loop->sigmask, SIGINT);
+    sigaddset(&loop->sigmask, SIGTERM);
+    sigaddset(&loop->sigmask, SIGHUP);
+    if (sigprocmask(SIG_BLOCK, &loop->sigmask, NULL) == -1) {
+        perror("Error blocking signals");
+        return -1;
+    }
+    loop->sigfd = signalfd(-1, &loop->sigmask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (loop->sigfd == -1) {
+        perror("Error creating signalfd");
+        return -1;
+    }
+    return add_source(loop, loop->sigfd, SOURCE_SIGNAL) < 0 ? -1 : 0;
+}
+
+void evloop_close(struct evloop *loop) {
+    for (int i = 0; i < loop->nsources; i++) {
+        remove_source(loop, i);
+    }
+    close(loop->epfd);
+    sigprocmask(SIG_UNBLOCK, &loop->sigmask, NULL);
+}
+
+int evloop_set_timer(struct evloop *loop, int timer, long interval_ns) {
+    struct evloop_source *src = &loop->sources[timer];
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.it_interval.tv_sec = interval_ns / 1000000000L;
+    spec.it_interval.tv_nsec = interval_ns % 1000000000L;
+    int flags = 0;
+
+    if (interval_ns > 0 && src->align) {
+        // First expiry on the next whole second of the wall clock
+        clock_gettime(CLOCK_REALTIME, &spec.it_value);
+        spec.it_value.tv_sec++;
+        spec.it_value.tv_nsec = 0;
+        flags = TFD_TIMER_ABSTIME;
+    } else {
+        spec.it_value = spec.it_interval;
+    }
+
+    if (timerfd_settime(src->fd, flags, &spec, NULL) == -1) {
+        perror("Error arming timer");
+        return -1;
+    }
+    return 0;
+}
+
+int evloop_add_timer(struct evloop *loop, long interval_ns, int align, evloop_timer_fn fn, void *ctx) {
+    int fd = timerfd_create(align ? CLOCK_REALTIME : CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd == -1) {
+        perror("Error creating timer");
+        return -1;
+    }
+    int index = add_source(loop, fd, SOURCE_TIMER);
+    if (index < 0) return -1;
+    loop->sources[index].align = align;
+    loop->sources[index].on_timer = fn;
+    loop->sources[index].ctx = ctx;
+    if (evloop_set_timer(loop, index, interval_ns) != 0) return -1;
+    return index;
+}
+
+// Only devices with letter keys count; mice and power buttons would just wake us
+static int is_keyboard(int fd) {
+    unsigned long keys[KEY_MAX / BITS_PER_LONG + 1];
+    memset(keys, 0, sizeof(keys));
+    if (ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(keys)), keys) < 0) return 0;
+    return TEST_BIT(KEY_Q, keys) && TEST_BIT(KEY_SPACE, keys);
+}
+
+static int add_key_source(struct evloop *loop, int fd, int kind, evloop_key_fn fn, void *ctx) {
+    int index = add_source(loop, fd, kind);
+    if (index < 0) return -1;
+    loop->sources[index].on_key = fn;
+    loop->sources[index].ctx = ctx;
+    return index;
+}
+
+int evloop_add_input(struct evloop *loop, evloop_key_fn fn, void *ctx) {
+    const char *path = getenv("FB_INPUT");
+    if (path != NULL) {
+        struct stat st;
+        if (stat(path, &st) == -1) {
+            perror("Error opening $FB_INPUT");
+            return 0;
+        }
+        // Opening the FIFO read-write keeps it from reporting hangup between writers
+        int fifo = S_ISFIFO(st.st_mode);
+        int fd = open(path, (fifo ? O_RDWR : O_RDONLY) | O_NONBLOCK | O_CLOEXEC);
+        if (fd == -1) {
+            perror("Error opening $FB_INPUT");
+            return 0;
+        }
+        return add_key_source(loop, fd, fifo ? SOURCE_FIFO : SOURCE_EVDEV, fn, ctx) < 0 ? 0 : 1;
+    }
+
+    int opened = 0;
+    DIR *dir = opendir("/dev/input");
+    if (dir == NULL) return 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, "event", 5) != 0) continue;
+        char node[300];
+        snprintf(node, sizeof(node), "/dev/input/%s", entry->d_name);
+        int fd = open(node, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        if (fd == -1) continue;
+        if (!is_keyboard(fd)) {
+            close(fd);
+            continue;
+        }
+        if (add_key_source(loop, fd, SOURCE_EVDEV, fn, ctx) >= 0) opened++;
+    }
+    closedir(dir);
+    return opened;
+}
+
+int evloop_on_signal(struct evloop *loop, int signo, evloop_signal_fn fn, void *ctx) {
+    if (loop->nsignals == EVLOOP_MAX_SIGNALS) return -1;
+    loop->signals[loop->nsignals].signo = signo;
+    loop->signals[loop->nsignals].fn = fn;
+    loop->signals[loop->nsignals].ctx = ctx;
+    loop->nsignals++;
+
+    sigaddset(&loop->sigmask, signo);
+    if (sigprocmask(SIG_BLOCK, &loop->sigmask, NULL) == -1 ||
+        signalfd(loop->sigfd, &loop->sigmask, 0) == -1) {
+        perror("Error watching signal");
+        return -1;
+    }
+    return 0;
+}
+
+// Stand-in key codes for FIFO input
+static int fifo_key(char c) {
+    switch (c) {
+        case ' ': return KEY_SPACE;
+        case 'p': return KEY_P;
+        case 'r': return KEY_R;
+        case 'q': return KEY_Q;
+        case '+': return KEY_UP;
+        case '-': return KEY_DOWN;
+        default: return -1;
+    }
+}
+
+static void dispatch(struct evloop *loop, int index, uint32_t events) {
+    struct evloop_source *src = &loop->sources[index];
+
+    switch (src->kind) {
+    case SOURCE_TIMER: {
+        uint64_t expirations;
+        if (read(src->fd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+            src->on_timer(loop, expirations, src->ctx);
+        }
+        break;
+    }
+    case SOURCE_EVDEV: {
+        struct input_event ev[16];
+        ssize_t n = read(src->fd, ev, sizeof(ev));
+        if (n < 0 && errno != EAGAIN) {
+            remove_source(loop, index);  // Unplugged
+            break;
+        }
+        for (ssize_t i = 0; i < n / (ssize_t)sizeof(ev[0]); i++) {
+            if (ev[i].type == EV_KEY && ev[i].value != 0 && !loop->suspended) {  // Press or autorepeat
+                src->on_key(loop, ev[i].code, src->ctx);
+            }
+        }
+        break;
+    }
+    case SOURCE_FIFO: {
+        char buf[64];
+        ssize_t n = read(src->fd, buf, sizeof(buf));
+        for (ssize_t i = 0; i < n; i++) {
+            int key = fifo_key(buf[i]);
+            if (key >= 0 && !loop->suspended) src->on_key(loop, key, src->ctx);
+        }
+        break;
+    }
+    case SOURCE_SIGNAL: {
+        struct signalfd_siginfo info;
+        while (read(src->fd, &info, sizeof(info)) == sizeof(info)) {
+            int handled = 0;
+            for (int i = 0; i < loop->nsignals; i++) {
+                if (loop->signals[i].signo == (int)info.ssi_signo) {
+                    loop->signals[i].fn(loop, info.ssi_signo, loop->signals[i].ctx);
+                    handled = 1;
+                }
+            }
+            if (!handled) loop->running = 0;  // SIGINT, SIGTERM, SIGHUP
+        }
+        break;
+    }
+    }
+
+    if (src->fd >= 0 && (events & (EPOLLHUP | EPOLLERR))) {
+        remove_source(loop, index);
+    }
+}
+
+void evloop_run(struct evloop *loop, evloop_redraw_fn redraw, void *ctx) {
+    struct epoll_event events[16];
+    loop->running = 1;
+
+    while (loop->running) {
+        if (loop->dirty && !loop->suspended) {
+            loop->dirty = 0;
+            redraw(ctx);
+        }
+        int n = epoll_wait(loop->epfd, events, 16, -1);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            perror("Error waiting for events");
+            break;
+        }
+        for (int i = 0; i < n && loop->running; i++) {
+            dispatch(loop, events[i].data.u32, events[i].events);
+        }
+    }
+}
+
+void evloop_pacer_init(struct evloop_pacer *pacer, int timer, long base_ns, long max_ns) {
+    memset(pacer, 0, sizeof(*pacer));
+    pacer->timer = timer;
+    pacer->base_ns = base_ns;
+    pacer->max_ns = max_ns;
+    pacer->current_ns = base_ns;
+}
+
+// FNV-1a
+static uint64_t hash_key(const void *key, size_t len) {
+    const unsigned char *p = key;
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ p[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+int evloop_pacer_update(struct evloop *loop, struct evloop_pacer *pacer, const void *key, size_t len) {
+    uint64_t hash = hash_key(key, len);
+    if (pacer->have_key && hash == pacer->last_key) {
+        if (pacer->current_ns < pacer->max_ns) {
+            pacer->current_ns *= 2;
+            if (pacer->current_ns > pacer->max_ns) pacer->current_ns = pacer->max_ns;
+            evloop_set_timer(loop, pacer->timer, pacer->current_ns);
+        }
+        return 0;
+    }
+
+    pacer->last_key = hash;
+    pacer->have_key = 1;
+    if (pacer->current_ns != pacer->base_ns) {
+        pacer->current_ns = pacer->base_ns;
+        evloop_set_timer(loop, pacer->timer, pacer->current_ns);
+    }
+    return 1;
+}
+
+void evloop_pacer_reset(struct evloop *loop, struct evloop_pacer *pacer) {
+    pacer->have_key = 0;
+    if (pacer->current_ns != pacer->base_ns) {
+        pacer->current_ns = pacer->base_ns;
+        evloop_set_timer(loop, pacer->timer, pacer->current_ns);
+    }
+}
+
+void evloop_pacer_set_base(struct evloop_pacer *pacer, long base_ns) {
+    pacer->base_ns = base_ns;
+}
@@ -0,0 +1,74 @@
+#include "../include/graph.h"
+#include "../include/blend.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define FILL_ALPHA 80
+
+int graph_init(struct graph *graph, int width, int height, uint32_t color) {
+    memset(graph, 0, sizeof(*graph));
+    graph->width = width;
+    graph->height = height;
+    graph->color = color & 0xFFFFFF;
+    graph->ring = calloc(width, 1);
+    graph->strip = calloc((size_t)width * height, sizeof(uint32_t));  // Transparent
+    if (graph->ring == NULL || graph->strip == NULL) {
+        graph_free(graph);
+        return -1;
+    }
+    return 0;
+}
+
+void graph_free(struct graph *graph) {
+    free(graph->ring);
+    free(graph->strip);
+    graph->ring = NULL;
+    graph->strip = NULL;
+}
+
+// Premultiply an xRGB colour by alpha
+static uint32_t premultiply(uint32_t color, int alpha) {
+    uint32_t rb = ((color & 0xFF00FF) * alpha + 0x800080) >> 8 & 0xFF00FF;
+    uint32_t g = ((color & 0x00FF00) * alpha + 0x008000) >> 8 & 0x00FF00;
+    return (uint32_t)alpha << 24 | rb | g;
+}
+
+// Strip row of the top of a sample's area
+static int sample_row(const struct graph *graph, int value) {
+    return (graph->height - 1) - value * (graph->height - 1) / 100;
+}
+
+void graph_push(struct graph *graph, int value) {
+    if (value < 0) value = 0;
+    if (value > 100) value = 100;
+    int prev = graph->count > 0 ? graph->ring[graph->newest] : value;
+
+    graph->newest = (graph->newest + 1) % graph->width;
+    graph->ring[graph->newest] = value;
+    if (graph->count < graph->width) graph->count++;
+
+    // Scroll every row left by one column
+    int w = graph->width;
+    for (int y = 0; y < graph->height; y++) {
+        uint32_t *row = graph->strip + (size_t)y * w;
+        memmove(row, row + 1, (size_t)(w - 1) * sizeof(uint32_t));
+    }
+
+    // New right-hand column: the line joins the previous sample, with the fill below it
+    int top = sample_row(graph, value);
+    int from = sample_row(graph, prev);
+    int line_top = from < top ? from : top;
+    int line_bottom = from < top ? top : from;
+    uint32_t line = premultiply(graph->color, 255);
+    uint32_t fill = premultiply(graph->color, FILL_ALPHA);
+    uint32_t *col = graph->strip + (w - 1);
+    for (int y = 0; y < graph->height; y++) {
+        col[(size_t)y * w] = y < line_top ? 0 : y <= line_bottom ? line : fill;
+    }
+}
+
+void graph_draw(const struct graph *graph, int *framebuffer, struct fb_var_screeninfo vinfo, int x, int y, int width) {
+    if (width > graph->width) width = graph->width;
+    if (width <= 0) return;
+    blend_over_rect(framebuffer, vinfo, graph->strip + (graph->width - width), graph->width, x, y, width, graph->height);
+}
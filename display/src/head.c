@@ -0,0 +1,322 @@
+#define _GNU_SOURCE  // pthread_setaffinity_np
+#include "../include/head.h"
+#include "../include/present.h"
+#include "../include/profile.h"
+#include "../include/rotate.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+
+int head_open(struct head *head, const char *path, int index, struct surface_pool *pool) {
+    memset(head, 0, sizeof(*head));
+    snprintf(head->path, sizeof(head->path), "%s", path);
+    head->index = index;
+    head->pool = pool;
+    head->timer_fd = head->wake_fd = head->ack_fd = -1;
+
+    head->fd = open(path, O_RDWR | O_CLOEXEC);
+    if (head->fd == -1) {
+        perror("Error: cannot open framebuffer device");
+        return -1;
+    }
+    if (ioctl(head->fd, FBIOGET_VSCREENINFO, &head->device_vinfo) ||
+        ioctl(head->fd, FBIOGET_FSCREENINFO, &head->finfo)) {
+        perror("Error reading screen information");
+        close(head->fd);
+        return -1;
+    }
+    head->vinfo = head->device_vinfo;
+    if (head->vinfo.bits_per_pixel < 16) {
+        fprintf(stderr, "Error: %s is %u bpp, need 16, 24 or 32\n", path, head->vinfo.bits_per_pixel);
+        close(head->fd);
+        return -1;
+    }
+
+    head->device_size = (size_t)head->finfo.line_length * head->vinfo.yres_virtual;
+    head->device = mmap(0, head->device_size, PROT_READ | PROT_WRITE, MAP_SHARED, head->fd, 0);
+    if (head->device == MAP_FAILED) {
+        perror("Error mapping framebuffer device to memory");
+        close(head->fd);
+        return -1;
+    }
+
+    head->shadow = alloc_shadow(pool, &head->shadow_surface, head->vinfo);
+    if (head->shadow == NULL) {
+        munmap(head->device, head->device_size);
+        close(head->fd);
+        return -1;
+    }
+    head->native = present_is_native(head->vinfo, head->finfo);
+    return 0;
+}
+
+// The frame turned for the device: at the device's row length when it is
+// the panel's size, so the unscaled present paths can copy it as they would
+// the shadow. It is only kept in RAM when it has to go through scaling,
+// conversion or the diff first.
+static int update_rotated(struct head *head) {
+    surface_free(head->pool, &head->rotated_surface);
+    head->rotated = NULL;
+    if (head->rotation == 0) return 0;
+
+    struct fb_var_screeninfo turned = head->scaled ? head->vinfo : head->device_vinfo;
+    turned.xres = head->rotation == 180 ? head->vinfo.xres : head->vinfo.yres;
+    turned.yres = head->rotation == 180 ? head->vinfo.yres : head->vinfo.xres;
+    if (head->scaled) turned.xres_virtual = turned.xres;
+    turned.yres_virtual = turned.yres;
+    turned.xoffset = turned.yoffset = 0;
+    head->rotated_vinfo = turned;
+
+    if (!head->scaled && head->native && head->diff.previous == NULL) return 0;
+    head->rotated = alloc_shadow(head->pool, &head->rotated_surface, turned);
+    return head->rotated == NULL ? -1 : 0;
+}
+
+int head_set_rotation(struct head *head, int rotation) {
+    head->rotation = rotation;
+    if (rotation == 90 || rotation == 270) {
+        // Drawn upright, the panel is as wide as the device is tall
+        struct fb_var_screeninfo upright = head->device_vinfo;
+        upright.xres = upright.xres_virtual = head->device_vinfo.yres;
+        upright.yres = upright.yres_virtual = head->device_vinfo.xres;
+        upright.xoffset = upright.yoffset = 0;
+        struct surface surface;
+        int *shadow = alloc_shadow(head->pool, &surface, upright);
+        if (shadow == NULL) return -1;
+        surface_free(head->pool, &head->shadow_surface);
+        head->shadow_surface = surface;
+        head->shadow = shadow;
+        head->vinfo = upright;
+    }
+    return update_rotated(head);
+}
+
+int head_set_resolution(struct head *head, int width, int height) {
+    int sideways = head->rotation == 90 || head->rotation == 270;
+    int panel_w = sideways ? head->device_vinfo.yres : head->device_vinfo.xres;
+    int panel_h = sideways ? head->device_vinfo.xres : head->device_vinfo.yres;
+    if (width == panel_w && height == panel_h) return 0;
+    if (width <= 0 || height <= 0 || width > panel_w || height > panel_h) {
+        fprintf(stderr, "Error: %dx%d does not fit %s (%dx%d)\n", width, height, head->path, panel_w, panel_h);
+        return -1;
+    }
+
+    // The shadow is only ever the logical frame: no virtual area, no panning
+    struct fb_var_screeninfo logical = head->device_vinfo;
+    logical.xres = logical.xres_virtual = width;
+    logical.yres = logical.yres_virtual = height;
+    logical.xoffset = logical.yoffset = 0;
+
+    // The scaler takes the frame after it has been turned
+    struct fb_var_screeninfo scaled_from = logical;
+    if (sideways) {
+        scaled_from.xres = scaled_from.xres_virtual = height;
+        scaled_from.yres = scaled_from.yres_virtual = width;
+    }
+
+    struct surface surface;
+    int *shadow = alloc_shadow(head->pool, &surface, logical);
+    if (shadow == NULL) return -1;
+    if (present_scale_init(&head->scale, head->pool, scaled_from, head->device_vinfo) != 0) {
+        perror("Error allocating scaler");
+        present_scale_free(&head->scale, head->pool);
+        surface_free(head->pool, &surface);
+        return -1;
+    }
+    surface_free(head->pool, &head->shadow_surface);
+    head->shadow_surface = surface;
+    head->shadow = shadow;
+    head->vinfo = logical;
+    head->scaled = 1;
+    return update_rotated(head);
+}
+
+int head_enable_diff(struct head *head) {
+    if (diff_init(&head->diff, (size_t)head->device_vinfo.xres * 4, head->device_vinfo.yres) != 0) {
+        perror("Error allocating diff buffer");
+        return -1;
+    }
+    return update_rotated(head);  // A rotated frame now has to be compared before it goes out
+}
+
+void head_close(struct head *head) {
+    if (head->scaled) present_scale_free(&head->scale, head->pool);
+    if (head->diff.previous != NULL) {
+        diff_report(&head->diff, head->path, stderr);
+        diff_free(&head->diff);
+    }
+    for (int i = 0; i < HEAD_GRAPHS; i++) {
+        graph_free(&head->history[i]);
+    }
+    wallpaper_free(&head->wallpaper);
+    surface_free(head->pool, &head->rotated_surface);
+    surface_free(head->pool, &head->shadow_surface);
+    munmap(head->device, head->device_size);
+    close(head->fd);
+}
+
+void head_present(struct head *head) {
+    struct diff *diff = head->diff.previous != NULL ? &head->diff : NULL;
+    const int *frame = head->shadow;
+    struct fb_var_screeninfo vinfo = head->vinfo;
+    if (head->rotation != 0) {
+        PROF_BEGIN(PROF_FLUSH);
+        // Straight to the device: into the page it is showing, as it may be panned
+        uint8_t *origin = (uint8_t *)head->device + (size_t)head->device_vinfo.yoffset * head->finfo.line_length +
+                          (size_t)head->device_vinfo.xoffset * 4;
+        uint8_t *out = head->rotated != NULL ? (uint8_t *)head->rotated : origin;
+        size_t out_stride = head->rotated != NULL ? head->rotated_vinfo.xres_virtual * 4 : head->finfo.line_length;
+        rotate_frame(out, out_stride, (const uint8_t *)head->shadow, head->vinfo.xres_virtual * 4,
+                     head->vinfo.xres, head->vinfo.yres, 4, head->rotation);
+        PROF_END(PROF_FLUSH);
+        if (head->rotated == NULL) {
+            PROF_COUNT(PROF_BYTES_FLUSHED, (size_t)head->vinfo.xres * head->vinfo.yres * 4);
+            return;
+        }
+        frame = head->rotated;
+        vinfo = head->rotated_vinfo;
+    }
+
+    if (head->scaled) {
+        present_scaled(head->device, frame, vinfo, head->device_vinfo, head->finfo, &head->scale, diff);
+    } else if (head->native) {
+        present_frame(head->device, frame, vinfo, diff);
+    } else {
+        present_convert(head->device, frame, vinfo, head->finfo, diff);
+    }
+}
+
+// First expiry on the next whole wall-clock second, then once a second; 0 disarms
+static void arm_frame_timer(struct head *head, int on) {
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    if (on) {
+        clock_gettime(CLOCK_REALTIME, &spec.it_value);
+        spec.it_value.tv_sec++;
+        spec.it_value.tv_nsec = 0;
+        spec.it_interval.tv_sec = 1;
+    }
+    timerfd_settime(head->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+static void *head_thread(void *arg) {
+    struct head *head = arg;
+    struct pollfd fds[2] = {
+        { .fd = head->timer_fd, .events = POLLIN },
+        { .fd = head->wake_fd, .events = POLLIN },
+    };
+    int dirty = 1;
+    int suspended = 0;
+
+    arm_frame_timer(head, 1);
+    while (__atomic_load_n(&head->running, __ATOMIC_ACQUIRE)) {
+        if (dirty && !suspended) {
+            dirty = 0;
+            head->render(head);
+        }
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR) continue;
+            perror("Error waiting for frame timer");
+            break;
+        }
+
+        uint64_t count;
+        if ((fds[0].revents & POLLIN) && read(head->timer_fd, &count, sizeof(count)) == sizeof(count)) {
+            dirty = 1;  // Missed ticks collapse into one frame
+        }
+        if ((fds[1].revents & POLLIN) && read(head->wake_fd, &count, sizeof(count)) == sizeof(count)) {
+            int now = __atomic_load_n(&head->suspended, __ATOMIC_ACQUIRE);
+            if (now != suspended) {
+                suspended = now;
+                arm_frame_timer(head, !suspended);
+                if (!suspended) {
+                    dirty = 1;
+                    diff_invalidate(&head->diff);  // Another VT has drawn over our last frame
+                }
+            }
+            // Between frames here, so the device is ours to give up
+            uint64_t one = 1;
+            if (suspended && write(head->ack_fd, &one, sizeof(one)) != sizeof(one)) {
+                perror("Error acknowledging suspend");
+            }
+        }
+    }
+
+    PROF_PUBLISH();
+    return NULL;
+}
+
+static void wake(struct head *head) {
+    uint64_t one = 1;
+    if (write(head->wake_fd, &one, sizeof(one)) != sizeof(one)) {
+        perror("Error waking render thread");
+    }
+}
+
+int head_start(struct head *head, head_render_fn render, int cpu) {
+    head->render = render;
+    head->running = 1;
+    head->timer_fd = timerfd_create(CLOCK_REALTIME, TFD_CLOEXEC);
+    head->wake_fd = eventfd(0, EFD_CLOEXEC);
+    head->ack_fd = eventfd(0, EFD_CLOEXEC);
+    if (head->timer_fd == -1 || head->wake_fd == -1 || head->ack_fd == -1) {
+        perror("Error creating render thread timers");
+        return -1;
+    }
+
+    // Signals belong to the main thread's event loop, not to the renderers
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int err = pthread_create(&head->thread, NULL, head_thread, head);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (err != 0) {
+        fprintf(stderr, "Error starting render thread for %s: %s\n", head->path, strerror(err));
+        return -1;
+    }
+
+    // Keep each head's shadow buffer and working set in one core's caches
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(head->thread, sizeof(set), &set);
+    return 0;
+}
+
+void head_stop(struct head *head) {
+    __atomic_store_n(&head->running, 0, __ATOMIC_RELEASE);
+    wake(head);
+    pthread_join(head->thread, NULL);
+    close(head->timer_fd);
+    close(head->wake_fd);
+    close(head->ack_fd);
+}
+
+void head_suspend(struct head *head, int suspended) {
+    __atomic_store_n(&head->suspended, suspended, __ATOMIC_RELEASE);
+    wake(head);
+}
+
+void head_wait_suspended(struct head *head) {
+    // A frame is milliseconds; a thread that never answers has died, so
+    // don't hold the VT switch up forever
+    struct pollfd fd = { .fd = head->ack_fd, .events = POLLIN };
+    uint64_t count;
+    int n;
+    while ((n = poll(&fd, 1, HEAD_ACK_TIMEOUT_MS)) == -1 && errno == EINTR) {
+    }
+    if (n != 1 || read(head->ack_fd, &count, sizeof(count)) != sizeof(count)) {
+        fprintf(stderr, "Warning: %s did not stop drawing in time\n", head->path);
+    }
+}
@@ -0,0 +1,332 @@
+#include "../include/present.h"
+#include "../include/profile.h"
+#include "../include/blend.h"
+#include "../include/diff.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+int *alloc_shadow(struct surface_pool *pool, struct surface *surface, struct fb_var_screeninfo vinfo) {
+    size_t bytes = (size_t)vinfo.yres_virtual * vinfo.xres_virtual * sizeof(int);
+    if (surface_alloc(pool, surface, bytes, 1, 1) != 0) {
+        perror("Error allocating shadow buffer");
+        return NULL;
+    }
+    memset(surface->pixels, 0, bytes);  // A reused block still has the last owner's pixels
+    return (int *)surface->pixels;
+}
+
+void stream_copy(void *dst, const void *src, size_t bytes) {
+#if defined(__x86_64__) || defined(__i386__)
+    uint8_t *d = dst;
+    const uint8_t *s = src;
+
+    // Align the destination so every store below is a full aligned 16 bytes
+    size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+    if (head > bytes) head = bytes;
+    memcpy(d, s, head);
+    d += head; s += head; bytes -= head;
+
+    // One cache line per iteration so each write-combining buffer fills completely
+    for (; bytes >= 64; bytes -= 64, d += 64, s += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i *)s);
+        __m128i b = _mm_loadu_si128((const __m128i *)(s + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(s + 32));
+        __m128i e = _mm_loadu_si128((const __m128i *)(s + 48));
+        _mm_stream_si128((__m128i *)d, a);
+        _mm_stream_si128((__m128i *)(d + 16), b);
+        _mm_stream_si128((__m128i *)(d + 32), c);
+        _mm_stream_si128((__m128i *)(d + 48), e);
+    }
+    for (; bytes >= 16; bytes -= 16, d += 16, s += 16) {
+        _mm_stream_si128((__m128i *)d, _mm_loadu_si128((const __m128i *)s));
+    }
+    memcpy(d, s, bytes);
+    _mm_sfence();
+#else
+    // ARM framebuffer mappings are already write-combined/uncached and
+    // memcpy issues wide store pairs, which is what we want there
+    memcpy(dst, src, bytes);
+#endif
+}
+
+// Row staging buffer, one per render thread
+static __thread uint8_t *row_buf = NULL;
+static __thread size_t row_cap = 0;
+
+static int reserve_row_buf(size_t bytes) {
+    if (bytes <= row_cap) return 0;
+    free(row_buf);
+    row_buf = malloc(bytes);
+    row_cap = row_buf == NULL ? 0 : bytes;
+    return row_buf == NULL ? -1 : 0;
+}
+
+static void pack_row(uint8_t *p, const uint32_t *src, int count, struct fb_var_screeninfo vinfo);
+
+// Write one row of xRGB pixels to device row `dst`, packed into the
+// device's format unless native. With a diff only the runs that changed
+// since the last frame go out. Returns the device bytes written.
+static size_t write_row(uint8_t *dst, const uint32_t *row, int y, struct fb_var_screeninfo vinfo, int native,
+                        uint8_t *packed, struct diff *diff) {
+    size_t bpp = native ? 4 : (vinfo.bits_per_pixel + 7) / 8;
+    if (diff == NULL) {
+        if (native) {
+            stream_copy(dst, row, (size_t)vinfo.xres * 4);
+        } else {
+            pack_row(packed, row, vinfo.xres, vinfo);
+            stream_copy(dst, packed, vinfo.xres * bpp);
+        }
+        return vinfo.xres * bpp;
+    }
+
+    size_t written = 0;
+    int n = diff_row(diff, y, (const uint8_t *)row);
+    for (int i = 0; i < n; i++) {
+        int x = diff->runs[2 * i] / 4, count = diff->runs[2 * i + 1] / 4 - x;
+        if (native) {
+            stream_copy(dst + x * 4, row + x, (size_t)count * 4);
+        } else {
+            pack_row(packed, row + x, count, vinfo);
+            stream_copy(dst + x * bpp, packed, count * bpp);
+        }
+        written += count * bpp;
+    }
+    return written;
+}
+
+void present_frame(int *device, const int *shadow, struct fb_var_screeninfo vinfo, struct diff *diff) {
+    PROF_BEGIN(PROF_FLUSH);
+    if (diff == NULL) {
+        size_t bytes = (size_t)vinfo.yres * vinfo.xres_virtual * sizeof(int);
+        stream_copy(device, shadow, bytes);
+        PROF_COUNT(PROF_BYTES_FLUSHED, bytes);
+    } else {
+        size_t written = 0;
+        for (unsigned int y = 0; y < vinfo.yres; y++) {
+            size_t offset = (size_t)y * vinfo.xres_virtual;
+            written += write_row((uint8_t *)(device + offset), (const uint32_t *)shadow + offset, y, vinfo, 1, NULL, diff);
+        }
+        diff_end_frame(diff, written, (size_t)vinfo.yres * vinfo.xres * 4);
+        PROF_COUNT(PROF_BYTES_FLUSHED, written);
+    }
+    PROF_END(PROF_FLUSH);
+}
+
+int present_is_native(struct fb_var_screeninfo vinfo, struct fb_fix_screeninfo finfo) {
+    return vinfo.bits_per_pixel == 32 &&
+           vinfo.red.offset == 16 && vinfo.red.length == 8 &&
+           vinfo.green.offset == 8 && vinfo.green.length == 8 &&
+           vinfo.blue.offset == 0 && vinfo.blue.length == 8 &&
+           finfo.line_length == vinfo.xres_virtual * 4;
+}
+
+// An 8-bit channel value at `length` bits: its top bits on a narrower
+// channel, or repeated down the low bits of a wider one (10-bit panels), so
+// 0xFF is still full intensity. A channel the device doesn't have is 0.
+static inline uint32_t channel_bits(uint32_t value, unsigned int length) {
+    if (length == 0) return 0;
+    if (length <= 8) return value >> (8 - length);
+    if (length > 32) length = 32;
+    uint32_t wide = 0;
+    unsigned int filled = 0;
+    for (; filled < length; filled += 8) wide = wide << 8 | value;
+    return wide >> (filled - length);
+}
+
+// Pack xRGB pixels into the device's format: fit each 8-bit channel to the
+// device's width and move it into place
+static void pack_row(uint8_t *p, const uint32_t *src, int count, struct fb_var_screeninfo vinfo) {
+    for (int x = 0; x < count; x++) {
+        uint32_t c = src[x];
+        uint32_t v = channel_bits((c >> 16) & 0xFF, vinfo.red.length) << vinfo.red.offset |
+                     channel_bits((c >> 8) & 0xFF, vinfo.green.length) << vinfo.green.offset |
+                     channel_bits(c & 0xFF, vinfo.blue.length) << vinfo.blue.offset;
+        switch (vinfo.bits_per_pixel) {
+            case 16: memcpy(p, &v, 2); p += 2; break;
+            case 24: p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p += 3; break;
+            default: memcpy(p, &v, 4); p += 4; break;
+        }
+    }
+}
+
+void present_convert(void *device, const int *shadow, struct fb_var_screeninfo vinfo, struct fb_fix_screeninfo finfo,
+                     struct diff *diff) {
+    size_t row_bytes = (size_t)vinfo.xres * ((vinfo.bits_per_pixel + 7) / 8);
+    if (reserve_row_buf(row_bytes) != 0) return;
+
+    PROF_BEGIN(PROF_FLUSH);
+    size_t written = 0;
+    for (unsigned int y = 0; y < vinfo.yres; y++) {
+        written += write_row((uint8_t *)device + (size_t)y * finfo.line_length,
+                             (const uint32_t *)shadow + (size_t)y * vinfo.xres_virtual, y, vinfo, 0, row_buf, diff);
+    }
+    if (diff != NULL) diff_end_frame(diff, written, row_bytes * vinfo.yres);
+    PROF_COUNT(PROF_BYTES_FLUSHED, written);
+    PROF_END(PROF_FLUSH);
+}
+
+// Next cache-line aligned `bytes` of a scaler's block
+static void *carve(uint8_t **next, size_t bytes) {
+    void *p = *next;
+    *next += (bytes + SURFACE_ALIGN - 1) & ~(size_t)(SURFACE_ALIGN - 1);
+    return p;
+}
+
+int present_scale_init(struct present_scale *scale, struct surface_pool *pool, struct fb_var_screeninfo logical,
+                       struct fb_var_screeninfo vinfo) {
+    memset(scale, 0, sizeof(*scale));
+    int sw = logical.xres, sh = logical.yres;
+    int dw = vinfo.xres, dh = vinfo.yres;
+    scale->src_w = sw;
+    scale->src_h = sh;
+
+    // Largest rectangle with the logical aspect ratio, centred
+    if ((int64_t)dw * sh <= (int64_t)dh * sw) {
+        scale->out_w = dw;
+        scale->out_h = (int)((int64_t)sh * dw / sw);
+    } else {
+        scale->out_h = dh;
+        scale->out_w = (int)((int64_t)sw * dh / sh);
+    }
+    scale->out_x = (dw - scale->out_w) / 2;
+    scale->out_y = (dh - scale->out_h) / 2;
+    if (scale->out_w % sw == 0 && scale->out_h % sh == 0 && scale->out_w / sw == scale->out_h / sh) {
+        scale->factor = scale->out_w / sw;
+    }
+
+    // Device-wide rows, where the replication kernel may write up to 3 pixels
+    // past the end, and for bilinear four arrays out_w long
+    size_t line = SURFACE_ALIGN - 1;
+    size_t out_row = ((size_t)dw + 4) * sizeof(uint32_t), packed = (size_t)dw * 4;
+    size_t columns = scale->factor > 0 ? 0 : (size_t)scale->out_w * sizeof(uint32_t);
+    size_t bytes = out_row + packed + 4 * columns + 6 * line;
+    if (surface_alloc(pool, &scale->buffers, bytes, 1, 1) != 0) return -1;
+    memset(scale->buffers.pixels, 0, bytes);
+    uint8_t *next = scale->buffers.pixels;
+    scale->out_row = carve(&next, out_row);
+    scale->packed = carve(&next, packed);
+    if (scale->factor > 0) return 0;
+
+    // Bilinear: source position of each output column, sampled at pixel centres
+    scale->x_index = carve(&next, columns);
+    scale->x_frac = carve(&next, scale->out_w);
+    scale->rows[0] = carve(&next, columns);
+    scale->rows[1] = carve(&next, columns);
+    for (int x = 0; x < scale->out_w; x++) {
+        int64_t pos = ((2 * (int64_t)x + 1) * sw * 256) / (2 * scale->out_w) - 128;  // 24.8
+        if (pos < 0) pos = 0;
+        if (pos > (int64_t)(sw - 1) * 256) pos = (int64_t)(sw - 1) * 256;
+        scale->x_index[x] = pos >> 8;
+        scale->x_frac[x] = pos & 255;
+    }
+    return 0;
+}
+
+void present_scale_free(struct present_scale *scale, struct surface_pool *pool) {
+    surface_free(pool, &scale->buffers);
+}
+
+// Repeat each pixel `factor` times: broadcast it and store whole vectors,
+// letting the next pixel overwrite the overhang
+static void replicate_row(uint32_t *dst, const uint32_t *src, int count, int factor) {
+#if defined(__x86_64__) || defined(__i386__)
+    for (int x = 0; x < count; x++, dst += factor) {
+        __m128i v = _mm_set1_epi32((int)src[x]);
+        for (int j = 0; j < factor; j += 4) _mm_storeu_si128((__m128i *)(dst + j), v);
+    }
+#elif defined(__ARM_NEON)
+    for (int x = 0; x < count; x++, dst += factor) {
+        uint32x4_t v = vdupq_n_u32(src[x]);
+        for (int j = 0; j < factor; j += 4) vst1q_u32(dst + j, v);
+    }
+#else
+    for (int x = 0; x < count; x++) {
+        for (int j = 0; j < factor; j++) *dst++ = src[x];
+    }
+#endif
+}
+
+// Horizontally interpolate one source row to the output width
+static void stretch_row(struct present_scale *scale, uint32_t *dst, const uint32_t *src) {
+    int last = scale->src_w - 1;
+    for (int x = 0; x < scale->out_w; x++) {
+        int i = scale->x_index[x];
+        uint32_t a = src[i], b = src[i < last ? i + 1 : last];
+        uint32_t f = scale->x_frac[x];
+        // Red/blue and green in separate lanes, as in blend.c
+        uint32_t rb = ((a & 0xFF00FF) * (256 - f) + (b & 0xFF00FF) * f) >> 8;
+        uint32_t g = ((a & 0x00FF00) * (256 - f) + (b & 0x00FF00) * f) >> 8;
+        dst[x] = (rb & 0xFF00FF) | (g & 0x00FF00);
+    }
+}
+
+// Cached stretched copy of source row y (the two most recent rows are kept)
+static const uint32_t *stretched(struct present_scale *scale, const int *shadow, struct fb_var_screeninfo logical, int y) {
+    for (int i = 0; i < 2; i++) {
+        if (scale->row_y[i] == y) return scale->rows[i];
+    }
+    int slot = scale->row_y[0] < scale->row_y[1] ? 0 : 1;  // Evict the row further up
+    stretch_row(scale, scale->rows[slot], (const uint32_t *)shadow + (size_t)y * logical.xres_virtual);
+    scale->row_y[slot] = y;
+    return scale->rows[slot];
+}
+
+// Write one finished device-width row
+static size_t emit_row(struct present_scale *scale, void *device, int y, struct fb_var_screeninfo vinfo, struct fb_fix_screeninfo finfo,
+                       int native, struct diff *diff) {
+    return write_row((uint8_t *)device + (size_t)y * finfo.line_length, scale->out_row, y, vinfo, native, scale->packed, diff);
+}
+
+void present_scaled(void *device, const int *shadow, struct fb_var_screeninfo logical, struct fb_var_screeninfo vinfo,
+                    struct fb_fix_screeninfo finfo, struct present_scale *scale, struct diff *diff) {
+    // Rows are written one at a time, so only the pixel format has to match
+    int native = vinfo.bits_per_pixel == 32 && vinfo.red.offset == 16 && vinfo.red.length == 8 &&
+                 vinfo.green.offset == 8 && vinfo.green.length == 8 && vinfo.blue.offset == 0 && vinfo.blue.length == 8;
+    uint32_t *content = scale->out_row + scale->out_x;
+    size_t written = 0;
+    PROF_BEGIN(PROF_FLUSH);
+
+    // Letterbox bars: the row buffer's margins stay black throughout
+    memset(scale->out_row, 0, (size_t)vinfo.xres * 4);
+    for (int y = 0; y < scale->out_y; y++) written += emit_row(scale, device, y, vinfo, finfo, native, diff);
+    for (int y = scale->out_y + scale->out_h; y < (int)vinfo.yres; y++) written += emit_row(scale, device, y, vinfo, finfo, native, diff);
+
+    if (scale->factor > 0) {
+        // Each replicated row is built once and written `factor` times
+        for (int sy = 0; sy < scale->src_h; sy++) {
+            replicate_row(content, (const uint32_t *)shadow + (size_t)sy * logical.xres_virtual, scale->src_w, scale->factor);
+            memset(content + scale->out_w, 0, (size_t)(vinfo.xres - scale->out_x - scale->out_w) * 4);  // Overhang
+            for (int k = 0; k < scale->factor; k++) {
+                written += emit_row(scale, device, scale->out_y + sy * scale->factor + k, vinfo, finfo, native, diff);
+            }
+        }
+    } else {
+        scale->row_y[0] = scale->row_y[1] = -1;  // The shadow has changed since last frame
+        for (int oy = 0; oy < scale->out_h; oy++) {
+            int64_t pos = ((2 * (int64_t)oy + 1) * scale->src_h * 256) / (2 * scale->out_h) - 128;
+            if (pos < 0) pos = 0;
+            if (pos > (int64_t)(scale->src_h - 1) * 256) pos = (int64_t)(scale->src_h - 1) * 256;
+            int y0 = pos >> 8, fy = pos & 255;
+            int y1 = y0 < scale->src_h - 1 ? y0 + 1 : y0;
+
+            // Vertical step: the upper row blended toward the lower one with the SIMD blit kernel
+            const uint32_t *upper = stretched(scale, shadow, logical, y0);
+            const uint32_t *lower = stretched(scale, shadow, logical, y1);
+            memcpy(content, upper, (size_t)scale->out_w * 4);
+            blend_blit_span(content, lower, fy * 255 / 256, scale->out_w);
+            written += emit_row(scale, device, scale->out_y + oy, vinfo, finfo, native, diff);
+        }
+    }
+
+    if (diff != NULL) diff_end_frame(diff, written, (size_t)vinfo.yres * vinfo.xres * ((vinfo.bits_per_pixel + 7) / 8));
+    PROF_COUNT(PROF_BYTES_FLUSHED, written);
+    PROF_END(PROF_FLUSH);
+}
@@ -0,0 +1,146 @@
+#include "../include/stroke.h"
+#include "../include/profile.h"
+#include <stdint.h>
+
+#define SUB (1 << STROKE_SUBPIXEL_BITS)
+#define HALF (SUB / 2)
+#define CAP_STEPS 8  // Segments per round cap
+
+// cos/sin of k * 180 / CAP_STEPS degrees in Q16, k = 0..CAP_STEPS
+static const int cap_cos[CAP_STEPS + 1] = { 65536, 60547, 46341, 25080, 0, -25080, -46341, -60547, -65536 };
+static const int cap_sin[CAP_STEPS + 1] = { 0, 25080, 46341, 60547, 65536, 60547, 46341, 25080, 0 };
+
+// Smallest integer >= v / SUB
+static inline int ceil_sub(int v) {
+    return -((-v) >> STROKE_SUBPIXEL_BITS);
+}
+
+static uint64_t isqrt64(uint64_t v) {
+    uint64_t root = 0, bit = 1ull << 62;
+    while (bit > v) bit >>= 2;
+    while (bit) {
+        if (v >= root + bit) {
+            v -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return root;
+}
+
+// Fill pixels x0 <= x < x1 of row y
+void fill_span(int *framebuffer, struct fb_var_screeninfo vinfo, int y, int x0, int x1, int color) {
+    if (y < 0 || y >= (int)vinfo.yres_virtual) return;
+    if (x0 < 0) x0 = 0;
+    if (x1 > (int)vinfo.xres_virtual) x1 = vinfo.xres_virtual;
+    if (x0 >= x1) return;
+    int *row = framebuffer + (size_t)y * vinfo.xres_virtual;
+    for (int x = x0; x < x1; ++x) row[x] = color;
+    PROF_COUNT(PROF_PIXELS, x1 - x0);
+}
+
+void fill_rect(int *framebuffer, struct fb_var_screeninfo vinfo, int x, int y, int w, int h, int color) {
+    for (int row = y; row < y + h; ++row) {
+        fill_span(framebuffer, vinfo, row, x, x + w, color);
+    }
+}
+
+// One side of a convex polygon, walked from its top vertex downwards by
+// stepping `dir` through the point list
+struct edge_chain {
+    int edge, dir;  // edge runs from points[edge] to points[edge + dir]
+};
+
+// x where the chain crosses the row centre yc, after moving on past any edges
+// that end at or above it. The start of the current edge is always at or
+// above yc, so each edge is visited once for the whole polygon. Crossings
+// are interpolated from the upper end, so an edge shared by two polygons
+// rounds the same way in both.
+static int chain_x(struct edge_chain *chain, const Point *points, int count, int yc) {
+    int next = (chain->edge + chain->dir + count) % count;
+    for (int steps = 1; points[next].y <= yc && steps < count; ++steps) {
+        chain->edge = next;
+        next = (next + chain->dir + count) % count;
+    }
+    Point a = points[chain->edge], b = points[next];
+    if (b.y <= a.y) return a.x;
+    return a.x + (int)((int64_t)(yc - a.y) * (b.x - a.x) / (b.y - a.y));
+}
+
+// Scanline fill of a convex polygon given in subpixel units. A pixel is
+// covered when its centre lies inside (left/top edges inclusive), so
+// polygons sharing an edge never touch the same pixel twice. Both sides
+// are walked down from the top vertex together rather than testing every
+// edge on every row; which one is left depends on the winding, so the
+// span is simply ordered per row.
+void fill_convex_polygon(int *framebuffer, struct fb_var_screeninfo vinfo, const Point *points, int count, int color) {
+    if (count < 3) return;
+
+    int top = 0, ymax = points[0].y;
+    for (int i = 1; i < count; ++i) {
+        if (points[i].y < points[top].y) top = i;
+        if (points[i].y > ymax) ymax = points[i].y;
+    }
+
+    int row_start = ceil_sub(points[top].y - HALF);
+    int row_end = ceil_sub(ymax - HALF);
+    if (row_start < 0) row_start = 0;
+    if (row_end > (int)vinfo.yres_virtual) row_end = vinfo.yres_virtual;
+
+    struct edge_chain forward = { top, 1 }, backward = { top, -1 };
+    for (int row = row_start; row < row_end; ++row) {
+        int yc = row * SUB + HALF;
+        int left = chain_x(&forward, points, count, yc);
+        int right = chain_x(&backward, points, count, yc);
+        if (left > right) {
+            int swap = left;
+            left = right;
+            right = swap;
+        }
+        fill_span(framebuffer, vinfo, row, ceil_sub(left - HALF), ceil_sub(right - HALF), color);
+    }
+}
+
+// Segment of the given width between two pixel centres, with butt or round caps
+void draw_thick_line(int *framebuffer, struct fb_var_screeninfo vinfo, int x0, int y0, int x1, int y1, int width, int cap, int color) {
+    int px0 = x0 * SUB + HALF, py0 = y0 * SUB + HALF;
+    int px1 = x1 * SUB + HALF, py1 = y1 * SUB + HALF;
+    int64_t dx = (int64_t)(x1 - x0) * SUB, dy = (int64_t)(y1 - y0) * SUB;
+    int64_t len = isqrt64(dx * dx + dy * dy);
+    if (len == 0) {
+        if (cap != STROKE_ROUND) return;
+        dx = SUB; len = SUB;  // A dot: any direction will do
+    }
+
+    // n is the normal and u the tangent, both half a line width long
+    int half_width = width * SUB / 2;
+    int nx = (int)(-dy * half_width / len), ny = (int)(dx * half_width / len);
+    int ux = ny, uy = -nx;
+
+    PROF_COUNT(PROF_LINES, 1);
+    if (cap != STROKE_ROUND) {
+        Point quad[4] = {
+            { px0 + nx, py0 + ny }, { px1 + nx, py1 + ny },
+            { px1 - nx, py1 - ny }, { px0 - nx, py0 - ny }
+        };
+        fill_convex_polygon(framebuffer, vinfo, quad, 4, color);
+        return;
+    }
+
+    // Capsule: half circle around the end point, then around the start point
+    Point capsule[2 * (CAP_STEPS + 1)];
+    int count = 0;
+    for (int k = 0; k <= CAP_STEPS; ++k) {
+        capsule[count].x = px1 + (int)(((int64_t)nx * cap_cos[k] + (int64_t)ux * cap_sin[k]) >> 16);
+        capsule[count].y = py1 + (int)(((int64_t)ny * cap_cos[k] + (int64_t)uy * cap_sin[k]) >> 16);
+        count++;
+    }
+    for (int k = 0; k <= CAP_STEPS; ++k) {
+        capsule[count].x = px0 - (int)(((int64_t)nx * cap_cos[k] + (int64_t)ux * cap_sin[k]) >> 16);
+        capsule[count].y = py0 - (int)(((int64_t)ny * cap_cos[k] + (int64_t)uy * cap_sin[k]) >> 16);
+        count++;
+    }
+    fill_convex_polygon(framebuffer, vinfo, capsule, count, color);
+}
@@ -0,0 +1,151 @@
+#include "../include/surface.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23  // Linux 5.14; older kernels return EINVAL and we touch the pages instead
+#endif
+
+void surface_pool_init(struct surface_pool *pool, int flags) {
+    memset(pool, 0, sizeof(*pool));
+    pool->flags = flags;
+}
+
+void surface_pool_destroy(struct surface_pool *pool) {
+    while (pool->free_list != NULL) {
+        struct surface_block *block = pool->free_list;
+        pool->free_list = block->next;
+        munmap(block->mem, block->bytes);
+        pool->mapped_bytes -= block->bytes;
+        if (block->backing == SURFACE_HUGETLB) pool->hugetlb_bytes -= block->bytes;
+        if (block->backing == SURFACE_THP) pool->thp_bytes -= block->bytes;
+        free(block);
+    }
+}
+
+// Anything from half a huge page up is rounded to whole huge pages; smaller
+// requests go to the next power of two
+static size_t size_class(size_t bytes) {
+    if (bytes >= SURFACE_HUGE_PAGE / 2) {
+        return (bytes + SURFACE_HUGE_PAGE - 1) / SURFACE_HUGE_PAGE * SURFACE_HUGE_PAGE;
+    }
+    size_t size = 4096;
+    while (size < bytes) size *= 2;
+    return size;
+}
+
+static void prefault(void *mem, size_t bytes) {
+    if (madvise(mem, bytes, MADV_POPULATE_WRITE) == 0) return;
+    long page = sysconf(_SC_PAGESIZE);
+    for (size_t offset = 0; offset < bytes; offset += page) {
+        ((volatile uint8_t *)mem)[offset] = 0;
+    }
+}
+
+static void *map_block(struct surface_pool *pool, size_t bytes, int *backing) {
+    int huge = bytes % SURFACE_HUGE_PAGE == 0;
+    int populate = (pool->flags & SURFACE_PREFAULT) ? MAP_POPULATE : 0;
+
+    if (huge && (pool->flags & SURFACE_HUGETLB)) {
+        void *mem = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | populate, -1, 0);
+        if (mem != MAP_FAILED) {
+            *backing = SURFACE_HUGETLB;
+            return mem;
+        }
+        // No hugetlbfs pages reserved; fall through to THP or small pages
+    }
+
+    void *mem;
+    *backing = 0;
+    if (huge && (pool->flags & SURFACE_THP)) {
+        // Over-map by one huge page and trim, so the block is 2 MB aligned
+        // and khugepaged/the fault path can back it with huge pages
+        size_t span = bytes + SURFACE_HUGE_PAGE;
+        uint8_t *raw = mmap(NULL, span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw == MAP_FAILED) return NULL;
+        uint8_t *aligned = (uint8_t *)(((uintptr_t)raw + SURFACE_HUGE_PAGE - 1) & ~(uintptr_t)(SURFACE_HUGE_PAGE - 1));
+        size_t head = aligned - raw;
+        size_t tail = span - head - bytes;
+        if (head > 0) munmap(raw, head);
+        if (tail > 0) munmap(aligned + bytes, tail);
+        if (madvise(aligned, bytes, MADV_HUGEPAGE) == 0) *backing = SURFACE_THP;
+        mem = aligned;
+    } else {
+        mem = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) return NULL;
+    }
+
+    // After the madvise, so the faults can already take huge pages
+    if (populate) prefault(mem, bytes);
+    return mem;
+}
+
+// Padded row length: a multiple of SURFACE_ALIGN that is not a multiple of 4 KB
+static size_t padded_stride(int width, int bytes_per_pixel) {
+    size_t stride = ((size_t)width * bytes_per_pixel + SURFACE_ALIGN - 1) & ~(size_t)(SURFACE_ALIGN - 1);
+    if (stride % 4096 == 0) stride += SURFACE_ALIGN;
+    return stride;
+}
+
+int surface_alloc(struct surface_pool *pool, struct surface *surface, int width, int height, int bytes_per_pixel) {
+    size_t stride = padded_stride(width, bytes_per_pixel);
+    size_t bytes = size_class(stride * height);
+    pool->allocs++;
+
+    // Reuse a free block of the same size class
+    struct surface_block **link = &pool->free_list;
+    while (*link != NULL && (*link)->bytes != bytes) link = &(*link)->next;
+    struct surface_block *block = *link;
+    if (block != NULL) {
+        *link = block->next;
+        pool->reuses++;
+    } else {
+        block = malloc(sizeof(*block));
+        if (block == NULL) return -1;
+        block->bytes = bytes;
+        block->mem = map_block(pool, bytes, &block->backing);
+        if (block->mem == NULL) {
+            perror("Error mapping surface");
+            free(block);
+            return -1;
+        }
+        pool->maps++;
+        pool->mapped_bytes += bytes;
+        if (block->backing == SURFACE_HUGETLB) pool->hugetlb_bytes += bytes;
+        if (block->backing == SURFACE_THP) pool->thp_bytes += bytes;
+    }
+    block->next = NULL;
+
+    pool->used_bytes += bytes;
+    if (pool->used_bytes > pool->peak_bytes) pool->peak_bytes = pool->used_bytes;
+
+    surface->pixels = block->mem;
+    surface->width = width;
+    surface->height = height;
+    surface->bytes_per_pixel = bytes_per_pixel;
+    surface->stride = stride;
+    surface->block = block;
+    return 0;
+}
+
+void surface_free(struct surface_pool *pool, struct surface *surface) {
+    struct surface_block *block = surface->block;
+    if (block == NULL) return;
+    pool->used_bytes -= block->bytes;
+    block->next = pool->free_list;
+    pool->free_list = block;
+    memset(surface, 0, sizeof(*surface));
+}
+
+void surface_pool_report(const struct surface_pool *pool, FILE *out) {
+    const double mb = 1024.0 * 1024.0;
+    fprintf(out, "Surface pool: %lu allocations (%lu reused, %lu mapped)\n", pool->allocs, pool->reuses, pool->maps);
+    fprintf(out, "  in use %.1f MB, peak %.1f MB, mapped %.1f MB (%.1f MB free)\n",
+            pool->used_bytes / mb, pool->peak_bytes / mb, pool->mapped_bytes / mb,
+            (pool->mapped_bytes - pool->used_bytes) / mb);
+    fprintf(out, "  backing: %.1f MB hugetlb, %.1f MB transparent huge pages, %.1f MB small pages\n",
+            pool->hugetlb_bytes / mb, pool->thp_bytes / mb,
+            (pool->mapped_bytes - pool->hugetlb_bytes - pool->thp_bytes) / mb);
+}
@@ -0,0 +1,327 @@
+#include "../include/wallpaper.h"
+#include "../include/profile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define READ_CHUNK 65536
+
+// Buffered input; refilled with fread so the per-byte path is a compare and a load
+struct reader {
+    FILE *file;
+    uint8_t buf[READ_CHUNK];
+    size_t pos;
+    size_t len;
+    int eof;
+};
+
+static int refill(struct reader *r) {
+    r->len = fread(r->buf, 1, sizeof(r->buf), r->file);
+    r->pos = 0;
+    if (r->len == 0) r->eof = 1;
+    return r->len > 0;
+}
+
+// Next byte, or 0 past the end (r->eof tells the difference)
+static inline uint8_t next_byte(struct reader *r) {
+    if (r->pos == r->len && !refill(r)) return 0;
+    return r->buf[r->pos++];
+}
+
+// Copy n bytes out of the stream
+static int read_bytes(struct reader *r, uint8_t *dst, size_t n) {
+    while (n > 0) {
+        if (r->pos == r->len && !refill(r)) return -1;
+        size_t chunk = r->len - r->pos < n ? r->len - r->pos : n;
+        memcpy(dst, r->buf + r->pos, chunk);
+        r->pos += chunk;
+        dst += chunk;
+        n -= chunk;
+    }
+    return 0;
+}
+
+// Streaming area scaler. Every source row is first reduced horizontally to
+// the target width, then summed into the destination row whose source span
+// covers it; the destination row is written out once its last source row
+// has arrived. Upscaling falls out of the same loop as nearest neighbour.
+struct scaler {
+    int src_w, src_h, dst_w, dst_h;
+    int *col_start;     // Destination column x covers source columns [col_start[x], col_end[x])
+    int *col_end;
+    uint32_t *col_recip;    // 65536 / span width, so averages are a multiply and a shift
+    uint32_t *hrow;     // Current source row at the target width
+    uint32_t *acc;      // Per-channel sums for the destination row being built
+    int acc_rows;
+    int dy;             // Next destination row
+    uint32_t *out;
+};
+
+// Rounded sum / n given recip = 65536 / n; never above 255 for sums of n bytes
+#define AVERAGE(sum, recip) ((uint32_t)(((uint64_t)(sum) * (recip) + 32768) >> 16))
+
+static inline int span_start(int i, int src, int dst) {
+    return (int)((int64_t)i * src / dst);
+}
+
+static inline int span_end(int i, int src, int dst) {
+    int start = span_start(i, src, dst);
+    int end = span_start(i + 1, src, dst);
+    return end > start ? end : start + 1;
+}
+
+static int scaler_init(struct scaler *s, int src_w, int src_h, struct wallpaper *wp) {
+    memset(s, 0, sizeof(*s));
+    s->src_w = src_w;
+    s->src_h = src_h;
+    s->dst_w = wp->width;
+    s->dst_h = wp->height;
+    s->out = wp->pixels;
+    s->col_start = malloc(s->dst_w * sizeof(int));
+    s->col_end = malloc(s->dst_w * sizeof(int));
+    s->col_recip = malloc(s->dst_w * sizeof(uint32_t));
+    s->hrow = malloc(s->dst_w * sizeof(uint32_t));
+    s->acc = calloc(3 * (size_t)s->dst_w, sizeof(uint32_t));
+    if (s->col_start == NULL || s->col_end == NULL || s->col_recip == NULL || s->hrow == NULL || s->acc == NULL) {
+        return -1;
+    }
+    for (int x = 0; x < s->dst_w; x++) {
+        s->col_start[x] = span_start(x, src_w, s->dst_w);
+        s->col_end[x] = span_end(x, src_w, s->dst_w);
+        s->col_recip[x] = 65536 / (s->col_end[x] - s->col_start[x]);
+    }
+    return 0;
+}
+
+static void scaler_free(struct scaler *s) {
+    free(s->col_start);
+    free(s->col_end);
+    free(s->col_recip);
+    free(s->hrow);
+    free(s->acc);
+}
+
+static void scaler_row(struct scaler *s, int sy, const uint32_t *row) {
+    // Same size: the decoded row is the cached row
+    if (s->src_w == s->dst_w && s->src_h == s->dst_h) {
+        memcpy(s->out + (size_t)sy * s->dst_w, row, s->dst_w * sizeof(uint32_t));
+        return;
+    }
+
+    for (int x = 0; x < s->dst_w; x++) {
+        int x0 = s->col_start[x];
+        int x1 = s->col_end[x];
+        if (x1 == x0 + 1) {
+            s->hrow[x] = row[x0];
+            continue;
+        }
+        uint32_t r = 0, g = 0, b = 0;
+        for (int i = x0; i < x1; i++) {
+            r += (row[i] >> 16) & 0xFF;
+            g += (row[i] >> 8) & 0xFF;
+            b += row[i] & 0xFF;
+        }
+        uint32_t recip = s->col_recip[x];
+        s->hrow[x] = AVERAGE(r, recip) << 16 | AVERAGE(g, recip) << 8 | AVERAGE(b, recip);
+    }
+
+    while (s->dy < s->dst_h && sy >= span_start(s->dy, s->src_h, s->dst_h)) {
+        uint32_t *acc = s->acc;
+        for (int x = 0; x < s->dst_w; x++) {
+            acc[3 * x] += (s->hrow[x] >> 16) & 0xFF;
+            acc[3 * x + 1] += (s->hrow[x] >> 8) & 0xFF;
+            acc[3 * x + 2] += s->hrow[x] & 0xFF;
+        }
+        s->acc_rows++;
+        if (sy + 1 < span_end(s->dy, s->src_h, s->dst_h)) return;  // More source rows to come
+
+        uint32_t *dst = s->out + (size_t)s->dy * s->dst_w;
+        uint32_t recip = 65536 / s->acc_rows;
+        for (int x = 0; x < s->dst_w; x++) {
+            dst[x] = AVERAGE(acc[3 * x], recip) << 16 | AVERAGE(acc[3 * x + 1], recip) << 8 | AVERAGE(acc[3 * x + 2], recip);
+        }
+        memset(acc, 0, 3 * (size_t)s->dst_w * sizeof(uint32_t));
+        s->acc_rows = 0;
+        s->dy++;  // When upscaling the next destination row may reuse this source row
+    }
+}
+
+// PPM header field: skips whitespace and # comments
+static int ppm_number(struct reader *r) {
+    uint8_t c = next_byte(r);
+    while (!r->eof && (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '#')) {
+        if (c == '#') {
+            while (!r->eof && c != '\n') c = next_byte(r);
+        }
+        c = next_byte(r);
+    }
+    int value = 0;
+    if (c < '0' || c > '9') return -1;
+    while (!r->eof && c >= '0' && c <= '9') {
+        value = value * 10 + (c - '0');
+        c = next_byte(r);
+    }
+    return value;  // The single whitespace after the number has been consumed
+}
+
+static int ppm_header(struct reader *r, int *width, int *height, int *wide) {
+    *width = ppm_number(r);
+    *height = ppm_number(r);
+    int maxval = ppm_number(r);
+    if (*width <= 0 || *height <= 0 || maxval <= 0 || maxval > 65535) return -1;
+    *wide = maxval > 255;
+    return 0;
+}
+
+static int ppm_rows(struct reader *r, struct scaler *s, uint32_t *row, int wide) {
+    int bytes_pp = wide ? 6 : 3;
+    uint8_t *raw = malloc((size_t)s->src_w * bytes_pp);
+    if (raw == NULL) return -1;
+    for (int y = 0; y < s->src_h; y++) {
+        if (read_bytes(r, raw, (size_t)s->src_w * bytes_pp) != 0) {
+            free(raw);
+            return -1;
+        }
+        const uint8_t *p = raw;
+        for (int x = 0; x < s->src_w; x++, p += bytes_pp) {
+            // 16-bit samples are big-endian; their high byte is the 8-bit value
+            row[x] = wide ? (uint32_t)p[0] << 16 | p[2] << 8 | p[4]
+                          : (uint32_t)p[0] << 16 | p[1] << 8 | p[2];
+        }
+        scaler_row(s, y, row);
+    }
+    free(raw);
+    return 0;
+}
+
+static uint32_t be32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static int qoi_header(struct reader *r, int *width, int *height) {
+    uint8_t header[10];  // After the "qoif" magic
+    if (read_bytes(r, header, sizeof(header)) != 0) return -1;
+    uint32_t w = be32(header), h = be32(header + 4);
+    if (w == 0 || h == 0 || w > 16384 || h > 16384) return -1;
+    *width = w;
+    *height = h;
+    return 0;
+}
+
+// QOI ops carry their state (previous pixel, index, pending run) across
+// rows, so the decoder just stops at the end of each row and carries on
+static int qoi_rows(struct reader *r, struct scaler *s, uint32_t *row) {
+    uint32_t index[64];
+    uint8_t pr = 0, pg = 0, pb = 0, pa = 255;
+    int run = 0;
+    memset(index, 0, sizeof(index));
+
+    for (int y = 0; y < s->src_h; y++) {
+        for (int x = 0; x < s->src_w; x++) {
+            if (run > 0) {
+                // Fill the rest of the run (up to the row end) at once; the
+                // repeated pixel is already in the index
+                int n = run < s->src_w - x ? run : s->src_w - x;
+                uint32_t px = (uint32_t)pr << 16 | pg << 8 | pb;
+                for (int i = 0; i < n; i++) row[x + i] = px;
+                run -= n;
+                x += n - 1;
+                continue;
+            }
+
+            uint8_t op = next_byte(r);
+            if (op == 0xFE) {
+                pr = next_byte(r); pg = next_byte(r); pb = next_byte(r);
+            } else if (op == 0xFF) {
+                pr = next_byte(r); pg = next_byte(r); pb = next_byte(r); pa = next_byte(r);
+            } else if ((op & 0xC0) == 0x00) {
+                uint32_t px = index[op];
+                pr = px >> 24; pg = px >> 16; pb = px >> 8; pa = px;
+            } else if ((op & 0xC0) == 0x40) {
+                pr += ((op >> 4) & 3) - 2;
+                pg += ((op >> 2) & 3) - 2;
+                pb += (op & 3) - 2;
+            } else if ((op & 0xC0) == 0x80) {
+                uint8_t next = next_byte(r);
+                int dg = (op & 0x3F) - 32;
+                pr += dg - 8 + ((next >> 4) & 0x0F);
+                pg += dg;
+                pb += dg - 8 + (next & 0x0F);
+            } else {
+                run = op & 0x3F;  // This pixel plus `run` more
+            }
+            if (r->eof) return -1;
+            index[(pr * 3 + pg * 5 + pb * 7 + pa * 11) & 63] = (uint32_t)pr << 24 | pg << 16 | pb << 8 | pa;
+            row[x] = (uint32_t)pr << 16 | pg << 8 | pb;  // Alpha is dropped: the wallpaper is the bottom layer
+        }
+        scaler_row(s, y, row);
+    }
+    return 0;
+}
+
+int wallpaper_load(struct wallpaper *wp, const char *path, int width, int height) {
+    memset(wp, 0, sizeof(*wp));
+    struct reader *r = malloc(sizeof(*r));
+    if (r == NULL) return -1;
+    r->pos = r->len = 0;
+    r->eof = 0;
+    r->file = fopen(path, "rb");
+    if (r->file == NULL) {
+        perror("Error opening wallpaper");
+        free(r);
+        return -1;
+    }
+
+    uint8_t magic[4];
+    int src_w = 0, src_h = 0, wide = 0, qoi = 0, result = -1;
+    if (read_bytes(r, magic, 2) == 0 && magic[0] == 'P' && magic[1] == '6') {
+        result = ppm_header(r, &src_w, &src_h, &wide);
+    } else if (read_bytes(r, magic + 2, 2) == 0 && memcmp(magic, "qoif", 4) == 0) {
+        qoi = 1;
+        result = qoi_header(r, &src_w, &src_h);
+    }
+    if (result != 0) {
+        fprintf(stderr, "Error: %s is not a binary PPM or QOI image\n", path);
+        fclose(r->file);
+        free(r);
+        return -1;
+    }
+
+    wp->width = width;
+    wp->height = height;
+    wp->pixels = malloc((size_t)width * height * sizeof(uint32_t));
+    uint32_t *row = malloc((size_t)src_w * sizeof(uint32_t));  // The only full-width source buffer
+    struct scaler s;
+    memset(&s, 0, sizeof(s));
+    if (wp->pixels == NULL || row == NULL || scaler_init(&s, src_w, src_h, wp) != 0) {
+        perror("Error allocating wallpaper");
+        result = -1;
+    } else {
+        result = qoi ? qoi_rows(r, &s, row) : ppm_rows(r, &s, row, wide);
+        if (result != 0) fprintf(stderr, "Error: %s is truncated\n", path);
+    }
+    scaler_free(&s);
+    free(row);
+    fclose(r->file);
+    free(r);
+    if (result != 0) wallpaper_free(wp);
+    return result;
+}
+
+void wallpaper_free(struct wallpaper *wp) {
+    free(wp->pixels);
+    wp->pixels = NULL;
+}
+
+void wallpaper_restore(const struct wallpaper *wp, int *framebuffer, struct fb_var_screeninfo vinfo) {
+    int rows = wp->height < (int)vinfo.yres_virtual ? wp->height : (int)vinfo.yres_virtual;
+    int cols = wp->width < (int)vinfo.xres_virtual ? wp->width : (int)vinfo.xres_virtual;
+    if (cols == (int)vinfo.xres_virtual && cols == wp->width) {
+        memcpy(framebuffer, wp->pixels, (size_t)rows * cols * sizeof(uint32_t));
+    } else {
+        for (int y = 0; y < rows; y++) {
+            memcpy(framebuffer + (size_t)y * vinfo.xres_virtual, wp->pixels + (size_t)y * wp->width, cols * sizeof(uint32_t));
+        }
+    }
+    PROF_COUNT(PROF_PIXELS, rows * cols);
+}
@@ -0,0 +1,27 @@
+// Emits the sine and reciprocal tables for include/fixed.h.
+// Runs on the build host, so it is free to use libm.
+#include <math.h>
+#include <stdio.h>
+#include "../include/fixed.h"
+
+int main(void) {
+    int quarter = 1 << FX_SIN_BITS;
+    int mantissas = 1 << FX_RECIP_BITS;
+
+    printf("// Generated by tools/gen_tables.c, do not edit\n");
+    printf("#include \"../include/fixed.h\"\n\n");
+
+    // Two entries past the quarter so interpolation at exactly 90 degrees stays in bounds
+    printf("const int32_t fx_sin_table[%d] = {\n", quarter + 2);
+    for (int i = 0; i < quarter + 2; i++) {
+        printf("    %ld,\n", lround(sin(i * M_PI / 2 / quarter) * FX_ONE));
+    }
+    printf("};\n\n");
+
+    printf("const uint32_t fx_recip_table[%d] = {\n", mantissas);
+    for (int i = 0; i < mantissas; i++) {
+        printf("    %lluu,\n", (unsigned long long)llround(ldexp(1.0, 31 + FX_RECIP_BITS) / (mantissas + i)));
+    }
+    printf("};\n");
+    return 0;
+}
@@ -0,0 +1,37 @@
+// include/format.h
+#ifndef FORMAT_H
+#define FORMAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/fb.h>
+
+// Pixel formats a frame file can be in, as laid out in memory (little
+// endian, the same as the framebuffer's own 16/24/32 bpp layouts). Rows are
+// converted to the device's format as they are copied out. The common pairs
+// have their own loops; anything else goes through xRGB and is packed with
+// the device's channel offsets.
+
+enum pixel_format {
+    PIX_XRGB8888,   // 0x00RRGGBB
+    PIX_RGB565,
+    PIX_RGB888,     // Bytes B, G, R
+    PIX_OTHER,      // Device only: some other layout, described by its vinfo
+};
+
+int format_bytes(int format);
+const char *format_name(int format);
+// Parse "xrgb8888", "rgb565" or "rgb888"; -1 if unknown
+int format_parse(const char *name);
+// The format of a device, PIX_OTHER if it is none of the above
+int format_of_device(struct fb_var_screeninfo vinfo);
+
+// Convert count pixels from src_format to the device's format. scratch
+// holds count xRGB pixels for conversions that go through xRGB.
+void convert_row(uint8_t *dst, int dst_format, const uint8_t *src, int src_format, int count,
+                 struct fb_var_screeninfo vinfo, uint32_t *scratch);
+
+// Copy with non-temporal stores: write-only, bypasses the cache
+void stream_copy(void *dst, const void *src, size_t bytes);
+
+#endif
@@ -0,0 +1,83 @@
+// include/frameq.h
+#ifndef FRAMEQ_H
+#define FRAMEQ_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "surface.h"
+
+// Hand-off between one render thread and one present thread. Finished
+// frames travel render -> present through a bounded single-producer/
+// single-consumer ring. Presented frames come back through a second ring
+// the other way and are drawn into again, so no buffer is ever allocated
+// per frame. Both rings are lock-free: each index is written by one side
+// only. A side only sleeps (on a futex) when its ring is empty.
+//
+// When every buffer is queued or on screen, the policy decides what the
+// render thread does: FRAMEQ_BLOCK waits for the presenter to hand one back,
+// and FRAMEQ_DROP skips drawing that frame.
+
+#define FRAMEQ_MAX 16               // Buffers per queue, a power of two
+
+enum frameq_policy {
+    FRAMEQ_BLOCK,
+    FRAMEQ_DROP,
+};
+
+struct frame {
+    struct surface surface;
+    uint64_t submitted_ns;          // CLOCK_MONOTONIC when queued for presenting
+    unsigned long seq;
+};
+
+struct frame_ring {
+    uint32_t head __attribute__((aligned(64)));  // Next slot to take; written by the consumer
+    uint32_t waiting;                            // Consumer is (about to be) asleep on `wakeups`
+    uint32_t tail __attribute__((aligned(64)));  // Next slot to fill; written by the producer
+    uint32_t wakeups;                            // Futex word: bumped on every push and on close
+    struct frame *slots[FRAMEQ_MAX] __attribute__((aligned(64)));
+};
+
+// Totals since start. Render-side fields are written by the render thread
+// and present-side fields by the present thread; read them with relaxed
+// atomics, or after both threads have stopped.
+struct frameq_stats {
+    unsigned long submitted;        // Render side
+    unsigned long dropped;
+    unsigned long blocked;          // Waits for a free buffer
+    unsigned long presented;        // Present side
+    uint64_t latency_ns;            // Submit to end of the device write, summed
+    uint64_t latency_max_ns;
+    unsigned long depth_hist[FRAMEQ_MAX + 1];  // Frames waiting when one was taken
+};
+
+struct frameq {
+    struct frame_ring ready;        // render -> present
+    struct frame_ring free;         // present -> render
+    int policy;
+    int count;                      // Buffers in the two rings together
+    int closed;
+    struct frameq_stats stats;
+};
+
+// Queue `count` buffers (at most FRAMEQ_MAX), all free to begin with
+void frameq_init(struct frameq *q, struct frame *frames, int count, int policy);
+// Wake both sides and make the waits below return NULL
+void frameq_close(struct frameq *q);
+
+// Render thread: a buffer to draw the next frame into, or NULL when the
+// frame should be dropped (FRAMEQ_DROP) or the queue was closed
+struct frame *frameq_acquire(struct frameq *q);
+void frameq_submit(struct frameq *q, struct frame *frame);
+// Render thread, holding no buffer: wait until every submitted frame has
+// been presented and handed back, so the device is left alone
+void frameq_drain(struct frameq *q);
+
+// Present thread: the oldest finished frame, waiting for one; NULL once closed
+struct frame *frameq_next(struct frameq *q);
+// Hand a presented frame back for reuse and account its latency
+void frameq_release(struct frameq *q, struct frame *frame);
+
+void frameq_report(const struct frameq *q, FILE *out);
+
+#endif
@@ -0,0 +1,80 @@
+// include/source.h
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "frameq.h"
+#include "surface.h"
+
+// Where frames come from. Input is raw frames back to back, or an "FBV1"
+// container: a 32-byte little-endian struct fbv_header, then the frames.
+//
+// A regular file is mmap'd read-only and frames are used in place, with no
+// copy. MADV_SEQUENTIAL asks for aggressive readahead. MADV_WILLNEED on the
+// next SOURCE_READAHEAD frames keeps the I/O ahead of playback.
+//
+// A pipe (or any other stream) is read by its own thread. Each frame lands
+// in one of SOURCE_RING pool surfaces via vmsplice(), falling back to
+// read() for streams that are not pipes. The surfaces are handed over
+// through include/frameq.h.
+
+#define FBV_MAGIC "FBV1"
+
+struct fbv_header {
+    char magic[4];
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;        // enum pixel_format (include/format.h)
+    uint32_t fps_num;       // Frame rate fps_num / fps_den; 0 if not given
+    uint32_t fps_den;
+    uint32_t frames;        // 0: until the end of the input
+    uint32_t reserved;
+};
+
+#define SOURCE_READAHEAD 8  // Frames ahead of playback asked for with MADV_WILLNEED
+#define SOURCE_RING 4       // Stream input: frames buffered between reader and player
+
+struct source {
+    int fd;
+    int width, height, format;
+    size_t frame_bytes;
+    double fps;             // From the container, 0 if not given
+    long frames;            // Frames in a file (0 for streams unless the container says)
+    int streaming;
+
+    // File input
+    const uint8_t *map;
+    size_t map_bytes;
+    size_t data_offset;
+    long advised;           // Frames [0, advised) have had MADV_WILLNEED
+
+    // Stream input
+    uint8_t prefix[sizeof(struct fbv_header)];  // Bytes read looking for a header that were frame data
+    size_t prefix_bytes;
+    int use_vmsplice;
+    int stop_fd;            // eventfd: tells the reader to give up
+    struct surface_pool pool;
+    struct frame ring[SOURCE_RING];
+    struct frameq queue;
+    struct frame *current;  // Being copied out; handed back by source_release()
+    pthread_t reader;
+    int reader_started;
+    uint64_t bytes_read;
+};
+
+// Open path ("-" for stdin). Raw input is taken to be width x height in
+// `format`; a container header overrides all three. Returns -1 on error.
+int source_open(struct source *src, const char *path, int width, int height, int format);
+// Frame n of a file (any n < frames, so it can loop), or the next frame of a
+// stream, waiting for it. NULL at the end of the input.
+const uint8_t *source_frame(struct source *src, long n);
+// Done with the last frame: a stream's buffer goes back to the reader
+void source_release(struct source *src);
+// Safe from a signal handler: make a stream's reader give up, so a
+// source_frame() waiting for input returns NULL once the queue is empty
+void source_interrupt(struct source *src);
+void source_close(struct source *src);
+
+#endif
@@ -0,0 +1,180 @@
+#include "../include/format.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#endif
+
+static const struct {
+    const char *name;
+    int bytes;
+} formats[] = {
+    [PIX_XRGB8888] = { "xrgb8888", 4 },
+    [PIX_RGB565] = { "rgb565", 2 },
+    [PIX_RGB888] = { "rgb888", 3 },
+    [PIX_OTHER] = { "other", 0 },
+};
+
+int format_bytes(int format) {
+    return formats[format].bytes;
+}
+
+const char *format_name(int format) {
+    return formats[format].name;
+}
+
+int format_parse(const char *name) {
+    for (int i = 0; i < PIX_OTHER; i++) {
+        if (strcmp(name, formats[i].name) == 0) return i;
+    }
+    return -1;
+}
+
+static int channels_are(struct fb_var_screeninfo vinfo, int r, int rl, int g, int gl, int b, int bl) {
+    return vinfo.red.offset == (unsigned)r && vinfo.red.length == (unsigned)rl &&
+           vinfo.green.offset == (unsigned)g && vinfo.green.length == (unsigned)gl &&
+           vinfo.blue.offset == (unsigned)b && vinfo.blue.length == (unsigned)bl;
+}
+
+int format_of_device(struct fb_var_screeninfo vinfo) {
+    if (vinfo.bits_per_pixel == 32 && channels_are(vinfo, 16, 8, 8, 8, 0, 8)) return PIX_XRGB8888;
+    if (vinfo.bits_per_pixel == 24 && channels_are(vinfo, 16, 8, 8, 8, 0, 8)) return PIX_RGB888;
+    if (vinfo.bits_per_pixel == 16 && channels_are(vinfo, 11, 5, 5, 6, 0, 5)) return PIX_RGB565;
+    return PIX_OTHER;
+}
+
+static void xrgb_to_rgb565(uint16_t *dst, const uint32_t *src, int count) {
+    int x = 0;
+#if defined(__x86_64__) || defined(__i386__)
+    // Eight pixels per iteration. packs_epi32 saturates signed, so the
+    // 16-bit results are biased by 0x8000 into range and back after packing.
+    const __m128i rmask = _mm_set1_epi32(0xF800), gmask = _mm_set1_epi32(0x07E0), bmask = _mm_set1_epi32(0x001F);
+    const __m128i bias32 = _mm_set1_epi32(0x8000), bias16 = _mm_set1_epi16((short)0x8000);
+    for (; x + 8 <= count; x += 8) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(src + x));
+        __m128i b = _mm_loadu_si128((const __m128i *)(src + x + 4));
+        a = _mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_srli_epi32(a, 8), rmask), _mm_and_si128(_mm_srli_epi32(a, 5), gmask)),
+                         _mm_and_si128(_mm_srli_epi32(a, 3), bmask));
+        b = _mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_srli_epi32(b, 8), rmask), _mm_and_si128(_mm_srli_epi32(b, 5), gmask)),
+                         _mm_and_si128(_mm_srli_epi32(b, 3), bmask));
+        __m128i packed = _mm_packs_epi32(_mm_sub_epi32(a, bias32), _mm_sub_epi32(b, bias32));
+        _mm_storeu_si128((__m128i *)(dst + x), _mm_xor_si128(packed, bias16));
+    }
+#endif
+    for (; x < count; x++) {
+        uint32_t c = src[x];
+        dst[x] = ((c >> 8) & 0xF800) | ((c >> 5) & 0x07E0) | ((c >> 3) & 0x001F);
+    }
+}
+
+// Into xRGB from any file format; the top bits of 5/6-bit channels are
+// repeated into the low ones so white stays white
+static void to_xrgb(uint32_t *dst, const uint8_t *src, int format, int count) {
+    switch (format) {
+        case PIX_XRGB8888:
+            memcpy(dst, src, (size_t)count * 4);
+            break;
+        case PIX_RGB565:
+            for (int x = 0; x < count; x++) {
+                uint32_t v = src[2 * x] | (uint32_t)src[2 * x + 1] << 8;
+                uint32_t r = (v >> 11) & 0x1F, g = (v >> 5) & 0x3F, b = v & 0x1F;
+                dst[x] = ((r << 3 | r >> 2) << 16) | ((g << 2 | g >> 4) << 8) | (b << 3 | b >> 2);
+            }
+            break;
+        case PIX_RGB888:
+            for (int x = 0; x < count; x++) {
+                dst[x] = src[3 * x] | (uint32_t)src[3 * x + 1] << 8 | (uint32_t)src[3 * x + 2] << 16;
+            }
+            break;
+    }
+}
+
+// An 8-bit channel value at `length` bits: its top bits on a narrower
+// channel, or repeated down the low bits of a wider one (10-bit panels), so
+// 0xFF is still full intensity
+static inline uint32_t channel_bits(uint32_t value, int length) {
+    if (length <= 8) return value >> (8 - length);
+    uint32_t wide = 0;
+    int filled = 0;
+    for (; filled < length; filled += 8) wide = wide << 8 | value;
+    return wide >> (filled - length);
+}
+
+// Out of xRGB into the device's format
+static void from_xrgb(uint8_t *dst, int format, const uint32_t *src, int count, struct fb_var_screeninfo vinfo) {
+    switch (format) {
+        case PIX_XRGB8888:
+            memcpy(dst, src, (size_t)count * 4);
+            break;
+        case PIX_RGB565:
+            xrgb_to_rgb565((uint16_t *)dst, src, count);
+            break;
+        case PIX_RGB888:
+            for (int x = 0; x < count; x++) {
+                dst[3 * x] = src[x];
+                dst[3 * x + 1] = src[x] >> 8;
+                dst[3 * x + 2] = src[x] >> 16;
+            }
+            break;
+        default: {
+            // Fit each 8-bit channel to the device's width and move it into place
+            int bytes = (vinfo.bits_per_pixel + 7) / 8;
+            for (int x = 0; x < count; x++, dst += bytes) {
+                uint32_t c = src[x];
+                uint32_t v = channel_bits((c >> 16) & 0xFF, vinfo.red.length) << vinfo.red.offset |
+                             channel_bits((c >> 8) & 0xFF, vinfo.green.length) << vinfo.green.offset |
+                             channel_bits(c & 0xFF, vinfo.blue.length) << vinfo.blue.offset;
+                memcpy(dst, &v, bytes);
+            }
+            break;
+        }
+    }
+}
+
+void convert_row(uint8_t *dst, int dst_format, const uint8_t *src, int src_format, int count,
+                 struct fb_var_screeninfo vinfo, uint32_t *scratch) {
+    if (dst_format == src_format) {
+        memcpy(dst, src, (size_t)count * format_bytes(src_format));
+    } else if (src_format == PIX_XRGB8888) {
+        from_xrgb(dst, dst_format, (const uint32_t *)src, count, vinfo);
+    } else if (dst_format == PIX_XRGB8888) {
+        to_xrgb((uint32_t *)dst, src, src_format, count);
+    } else {
+        to_xrgb(scratch, src, src_format, count);
+        from_xrgb(dst, dst_format, scratch, count, vinfo);
+    }
+}
+
+void stream_copy(void *dst, const void *src, size_t bytes) {
+#if defined(__x86_64__) || defined(__i386__)
+    uint8_t *d = dst;
+    const uint8_t *s = src;
+
+    // Align the destination so every store below is a full aligned 16 bytes
+    size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+    if (head > bytes) head = bytes;
+    memcpy(d, s, head);
+    d += head; s += head; bytes -= head;
+
+    // One cache line per iteration so each write-combining buffer fills completely
+    for (; bytes >= 64; bytes -= 64, d += 64, s += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i *)s);
+        __m128i b = _mm_loadu_si128((const __m128i *)(s + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(s + 32));
+        __m128i e = _mm_loadu_si128((const __m128i *)(s + 48));
+        _mm_stream_si128((__m128i *)d, a);
+        _mm_stream_si128((__m128i *)(d + 16), b);
+        _mm_stream_si128((__m128i *)(d + 32), c);
+        _mm_stream_si128((__m128i *)(d + 48), e);
+    }
+    for (; bytes >= 16; bytes -= 16, d += 16, s += 16) {
+        _mm_stream_si128((__m128i *)d, _mm_loadu_si128((const __m128i *)s));
+    }
+    memcpy(d, s, bytes);
+    _mm_sfence();
+#else
+    // ARM framebuffer mappings are already write-combined/uncached and
+    // memcpy issues wide store pairs, which is what we want there
+    memcpy(dst, src, bytes);
+#endif
+}
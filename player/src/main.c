@@ -0,0 +1,275 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/fb.h>
+#include "../include/profile.h"
+#include "../include/format.h"
+#include "../include/source.h"
+
+#define DEFAULT_FPS 60.0
+#define NS_PER_SEC 1000000000ull
+
+struct framebuffer_info {
+    int fb_fd;
+    uint8_t* fb_ptr;
+    struct fb_var_screeninfo vinfo;
+    struct fb_fix_screeninfo finfo;
+    size_t screensize;
+    int format;             // enum pixel_format, PIX_OTHER for anything else
+};
+
+// Where a frame lands: centred, cropped to whatever of it fits
+struct placement {
+    int src_x, src_y;
+    int dst_x, dst_y;
+    int width, height;
+};
+
+// Totals for the report printed at the end
+struct play_stats {
+    unsigned long frames;
+    unsigned long stalls;   // Frames that went out more than a frame interval late
+    uint64_t stall_ns;      // How late, beyond that interval, summed
+    uint64_t stall_max_ns;
+    uint64_t wait_ns;       // Stream input: time spent waiting for a frame that was due
+    uint64_t copy_ns;       // Conversion and device writes
+    uint64_t copy_max_ns;
+    uint64_t start_ns;
+    uint64_t end_ns;
+};
+
+static volatile sig_atomic_t running = 1;
+static struct source* interruptible;  // Stream input, whose reader a signal has to stop
+
+// A stream's reader is told to stop too: until it does, the wait for its
+// next frame sleeps through the signal
+static void stop(int sig) {
+    running = 0;
+    if (interruptible != NULL) source_interrupt(interruptible);
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t deadline) {
+    struct timespec ts = { deadline / NS_PER_SEC, deadline % NS_PER_SEC };
+    while (running && clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
+static void init_framebuffer(struct framebuffer_info* fb_info) {
+    const char* path = getenv("FRAMEBUFFER");
+    fb_info->fb_fd = open(path != NULL ? path : "/dev/fb0", O_RDWR | O_CLOEXEC);
+    if (fb_info->fb_fd == -1) {
+        perror("Error opening framebuffer device");
+        exit(1);
+    }
+    if (ioctl(fb_info->fb_fd, FBIOGET_FSCREENINFO, &fb_info->finfo) ||
+        ioctl(fb_info->fb_fd, FBIOGET_VSCREENINFO, &fb_info->vinfo)) {
+        perror("Error reading screen information");
+        exit(1);
+    }
+    if (fb_info->vinfo.bits_per_pixel < 16) {
+        fprintf(stderr, "Error: framebuffer is %u bpp, need 16, 24 or 32\n", fb_info->vinfo.bits_per_pixel);
+        exit(1);
+    }
+    fb_info->format = format_of_device(fb_info->vinfo);
+    fb_info->screensize = (size_t)fb_info->vinfo.yres_virtual * fb_info->finfo.line_length;
+    fb_info->fb_ptr = mmap(0, fb_info->screensize, PROT_READ | PROT_WRITE, MAP_SHARED, fb_info->fb_fd, 0);
+    if (fb_info->fb_ptr == MAP_FAILED) {
+        perror("Error mapping framebuffer to memory");
+        exit(1);
+    }
+}
+
+static uint8_t* device_row(const struct framebuffer_info* fb_info, int x, int y) {
+    int bytes = (fb_info->vinfo.bits_per_pixel + 7) / 8;
+    return fb_info->fb_ptr + (size_t)(y + fb_info->vinfo.yoffset) * fb_info->finfo.line_length +
+           (size_t)(x + fb_info->vinfo.xoffset) * bytes;
+}
+
+static struct placement place(const struct framebuffer_info* fb_info, int width, int height) {
+    struct placement p;
+    int xres = fb_info->vinfo.xres, yres = fb_info->vinfo.yres;
+    p.width = width < xres ? width : xres;
+    p.height = height < yres ? height : yres;
+    p.src_x = (width - p.width) / 2;
+    p.src_y = (height - p.height) / 2;
+    p.dst_x = (xres - p.width) / 2;
+    p.dst_y = (yres - p.height) / 2;
+    return p;
+}
+
+// Copy one frame's visible part to the device. Rows already in the device's
+// format are streamed straight from the source; others are converted into
+// a cached row buffer first.
+static void present(const struct framebuffer_info* fb_info, const uint8_t* frame, const struct source* src,
+                    const struct placement* p, uint8_t* row_buf, uint32_t* scratch) {
+    int src_bytes = format_bytes(src->format);
+    int dst_bytes = (fb_info->vinfo.bits_per_pixel + 7) / 8;
+    size_t src_stride = (size_t)src->width * src_bytes;
+    size_t out_bytes = (size_t)p->width * dst_bytes;
+
+    PROF_BEGIN(PROF_FLUSH);
+    for (int y = 0; y < p->height; y++) {
+        const uint8_t* in = frame + (size_t)(p->src_y + y) * src_stride + (size_t)p->src_x * src_bytes;
+        uint8_t* out = device_row(fb_info, p->dst_x, p->dst_y + y);
+        if (src->format == fb_info->format) {
+            stream_copy(out, in, out_bytes);
+        } else {
+            convert_row(row_buf, fb_info->format, in, src->format, p->width, fb_info->vinfo, scratch);
+            stream_copy(out, row_buf, out_bytes);
+        }
+    }
+    PROF_COUNT(PROF_BYTES_FLUSHED, out_bytes * p->height);
+    PROF_COUNT(PROF_PIXELS, (uint64_t)p->width * p->height);
+    PROF_END(PROF_FLUSH);
+}
+
+static void report(const struct play_stats* stats, const struct source* src, double fps, FILE* out) {
+    double seconds = (stats->end_ns - stats->start_ns) / 1e9;
+    fprintf(out, "Played %lu frames of %dx%d %s in %.2f s: %.1f fps sustained", stats->frames, src->width, src->height,
+            format_name(src->format), seconds, seconds > 0 ? stats->frames / seconds : 0.0);
+    if (fps > 0) fprintf(out, " (target %.1f)", fps);
+    fprintf(out, "\n");
+    if (stats->frames == 0) return;
+    fprintf(out, "  copy to device: %.2f ms average, %.2f ms worst\n", stats->copy_ns / 1e6 / stats->frames,
+            stats->copy_max_ns / 1e6);
+    fprintf(out, "  stalls: %lu frames late by more than a frame, %.1f ms in all, %.1f ms worst\n", stats->stalls,
+            stats->stall_ns / 1e6, stats->stall_max_ns / 1e6);
+    if (src->streaming) {
+        fprintf(out, "  input: %.1f MB read, %.1f ms waiting for due frames\n", src->bytes_read / 1e6, stats->wait_ns / 1e6);
+    }
+}
+
+// Usage: fb_player [-s WxH] [-f format] [-r fps] [-l] [file|-]
+// Plays raw frames, or an FBV1 container (include/source.h), to $FRAMEBUFFER
+// or /dev/fb0. Raw input is taken to be the panel's size and format unless
+// -s/-f say otherwise. -r sets the rate (0 plays as fast as possible) over
+// the container's or 60 fps; -l loops a file. Input is stdin without a file.
+int main(int argc, char* argv[]) {
+    int width = 0, height = 0, format = -1;
+    double fps = -1;
+    int loop = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:f:r:l")) != -1) {
+        switch (opt) {
+            case 's':
+                if (sscanf(optarg, "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0) {
+                    fprintf(stderr, "Error: bad size '%s'\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'f':
+                format = format_parse(optarg);
+                if (format < 0) {
+                    fprintf(stderr, "Error: unknown format '%s' (xrgb8888, rgb565 or rgb888)\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'r':
+                fps = atof(optarg);
+                break;
+            case 'l':
+                loop = 1;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-s WxH] [-f format] [-r fps] [-l] [file|-]\n", argv[0]);
+                exit(1);
+        }
+    }
+    const char* path = optind < argc ? argv[optind] : "-";
+
+    struct framebuffer_info fb_info;
+    init_framebuffer(&fb_info);
+    if (width == 0) {
+        width = fb_info.vinfo.xres;
+        height = fb_info.vinfo.yres;
+    }
+    if (format < 0) format = fb_info.format != PIX_OTHER ? fb_info.format : PIX_XRGB8888;
+
+    struct source src;
+    if (source_open(&src, path, width, height, format) != 0) {
+        source_close(&src);
+        exit(2);
+    }
+    if (fps < 0) fps = src.fps > 0 ? src.fps : DEFAULT_FPS;
+    uint64_t interval = fps > 0 ? (uint64_t)(NS_PER_SEC / fps) : 0;
+
+    struct placement p = place(&fb_info, src.width, src.height);
+    uint8_t* row_buf = malloc((size_t)p.width * 4);
+    uint32_t* scratch = malloc((size_t)p.width * 4);
+    if (row_buf == NULL || scratch == NULL) {
+        perror("Error allocating row buffers");
+        exit(3);
+    }
+    // Black around a frame smaller than the panel
+    if (p.width < (int)fb_info.vinfo.xres || p.height < (int)fb_info.vinfo.yres) {
+        for (unsigned int y = 0; y < fb_info.vinfo.yres; y++) {
+            memset(device_row(&fb_info, 0, y), 0, (size_t)fb_info.vinfo.xres * ((fb_info.vinfo.bits_per_pixel + 7) / 8));
+        }
+    }
+
+    if (src.streaming) interruptible = &src;
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+    PROF_INIT("player");
+
+    // Frame i is due at base + i * interval. A stall moves the schedule back
+    // rather than rushing the frames after it out to catch up.
+    struct play_stats stats;
+    memset(&stats, 0, sizeof(stats));
+    stats.start_ns = now_ns();
+    uint64_t base = stats.start_ns;
+    for (long n = 0, i = 0; running; n++, i++) {
+        if (loop && !src.streaming && n == src.frames) n = 0;
+        uint64_t due = base + i * interval;
+        if (interval > 0) sleep_until(due);
+        if (!running) break;
+
+        PROF_FRAME_BEGIN();
+        uint64_t t0 = now_ns();
+        const uint8_t* frame = source_frame(&src, n);
+        uint64_t t1 = now_ns();
+        if (frame == NULL) break;
+        stats.wait_ns += t1 - t0;
+
+        present(&fb_info, frame, &src, &p, row_buf, scratch);
+        source_release(&src);
+        uint64_t t2 = now_ns();
+        PROF_FRAME_END();
+
+        stats.frames++;
+        stats.copy_ns += t2 - t1;
+        if (t2 - t1 > stats.copy_max_ns) stats.copy_max_ns = t2 - t1;
+        if (interval > 0 && t2 > due + interval) {
+            uint64_t late = t2 - due - interval;
+            stats.stalls++;
+            stats.stall_ns += late;
+            if (late > stats.stall_max_ns) stats.stall_max_ns = late;
+            base = t2 - i * interval;  // The next frame is due one interval from now
+        }
+    }
+    stats.end_ns = now_ns();
+
+    PROF_SHUTDOWN();
+    report(&stats, &src, fps, stderr);
+    if (src.streaming) frameq_report(&src.queue, stderr);
+    interruptible = NULL;
+    source_close(&src);
+    free(row_buf);
+    free(scratch);
+    munmap(fb_info.fb_ptr, fb_info.screensize);
+    close(fb_info.fb_fd);
+    return 0;
+}
@@ -0,0 +1,236 @@
+#define _GNU_SOURCE  // vmsplice, F_SETPIPE_SZ
+#include "../include/source.h"
+#include "../include/format.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+// Take the geometry, format and rate from a container header
+static int parse_header(struct source *src, const struct fbv_header *header) {
+    if (header->width == 0 || header->height == 0 || header->format >= PIX_OTHER) {
+        fprintf(stderr, "Error: bad FBV1 header (%ux%u, format %u)\n", header->width, header->height, header->format);
+        return -1;
+    }
+    src->width = header->width;
+    src->height = header->height;
+    src->format = header->format;
+    src->fps = header->fps_num && header->fps_den ? (double)header->fps_num / header->fps_den : 0;
+    src->frames = header->frames;
+    return 0;
+}
+
+static int open_file(struct source *src, size_t size) {
+    src->map_bytes = size;
+    src->map = mmap(NULL, size, PROT_READ, MAP_SHARED, src->fd, 0);
+    if (src->map == MAP_FAILED) {
+        perror("Error mapping input");
+        src->map = NULL;
+        return -1;
+    }
+    madvise((void *)src->map, size, MADV_SEQUENTIAL);
+
+    if (size >= sizeof(struct fbv_header) && memcmp(src->map, FBV_MAGIC, 4) == 0) {
+        struct fbv_header header;
+        memcpy(&header, src->map, sizeof(header));
+        if (parse_header(src, &header) != 0) return -1;
+        src->data_offset = sizeof(header);
+    }
+    src->frame_bytes = (size_t)src->width * src->height * format_bytes(src->format);
+    long available = (size - src->data_offset) / src->frame_bytes;
+    if (src->frames == 0 || src->frames > available) src->frames = available;
+    if (src->frames == 0) {
+        fprintf(stderr, "Error: input is shorter than one %dx%d %s frame\n", src->width, src->height, format_name(src->format));
+        return -1;
+    }
+    return 0;
+}
+
+// Fill buf with exactly `bytes` bytes of input; -1 at the end of the input,
+// on an error, or when told to stop
+static int read_full(struct source *src, uint8_t *buf, size_t bytes) {
+    size_t got = 0;
+    while (got < bytes) {
+        struct pollfd fds[2] = {
+            { .fd = src->fd, .events = POLLIN },
+            { .fd = src->stop_fd, .events = POLLIN },
+        };
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR) continue;
+            perror("Error waiting for input");
+            return -1;
+        }
+        if (fds[1].revents & POLLIN) return -1;
+
+        ssize_t n;
+        if (src->use_vmsplice) {
+            // From a pipe, vmsplice() copies straight into our memory
+            struct iovec iov = { buf + got, bytes - got };
+            n = vmsplice(src->fd, &iov, 1, SPLICE_F_NONBLOCK);
+            if (n == -1 && (errno == EBADF || errno == EINVAL)) {
+                src->use_vmsplice = 0;  // Not a pipe
+                continue;
+            }
+        } else {
+            n = read(src->fd, buf + got, bytes - got);
+        }
+        if (n == 0) return -1;
+        if (n == -1) {
+            if (errno == EINTR || errno == EAGAIN) continue;
+            perror("Error reading input");
+            return -1;
+        }
+        got += n;
+        src->bytes_read += n;
+    }
+    return 0;
+}
+
+static void *reader_thread(void *arg) {
+    struct source *src = arg;
+    struct frame *frame;
+    while ((frame = frameq_acquire(&src->queue)) != NULL) {
+        uint8_t *pixels = frame->surface.pixels;
+        size_t have = src->prefix_bytes;
+        memcpy(pixels, src->prefix, have);  // The first frame starts with the bytes read for the header check
+        src->prefix_bytes = 0;
+        if (read_full(src, pixels + have, src->frame_bytes - have) != 0) break;
+        frameq_submit(&src->queue, frame);
+    }
+    // Frames already queued are still played, then source_frame() returns NULL
+    frameq_close(&src->queue);
+    return NULL;
+}
+
+static int open_stream(struct source *src) {
+    src->streaming = 1;
+    src->use_vmsplice = 1;
+    src->stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (src->stop_fd == -1) {
+        perror("Error creating reader eventfd");
+        return -1;
+    }
+
+    struct fbv_header header;
+    if (read_full(src, (uint8_t *)&header, sizeof(header)) != 0) {
+        fprintf(stderr, "Error: no input\n");
+        return -1;
+    }
+    if (memcmp(header.magic, FBV_MAGIC, 4) == 0) {
+        if (parse_header(src, &header) != 0) return -1;
+    } else {
+        memcpy(src->prefix, &header, sizeof(header));
+        src->prefix_bytes = sizeof(header);
+    }
+    src->frame_bytes = (size_t)src->width * src->height * format_bytes(src->format);
+    if (src->frame_bytes < sizeof(header)) {
+        fprintf(stderr, "Error: %dx%d frames are too small\n", src->width, src->height);
+        return -1;
+    }
+
+    // A pipe big enough for a whole frame lets the writer run a frame ahead
+    // (capped by /proc/sys/fs/pipe-max-size; failure just keeps the default)
+    int pipe_size = src->frame_bytes > (1u << 30) ? 1 << 30 : (int)src->frame_bytes;
+    while (pipe_size >= 65536 && fcntl(src->fd, F_SETPIPE_SZ, pipe_size) == -1 && errno == EPERM) pipe_size /= 2;
+
+    surface_pool_init(&src->pool, SURFACE_THP | SURFACE_PREFAULT);
+    for (int i = 0; i < SOURCE_RING; i++) {
+        // One row per frame: frames are read into contiguous memory
+        if (surface_alloc(&src->pool, &src->ring[i].surface, src->frame_bytes, 1, 1) != 0) {
+            return -1;
+        }
+    }
+    frameq_init(&src->queue, src->ring, SOURCE_RING, FRAMEQ_BLOCK);
+
+    // Signals stay with the playback thread
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int err = pthread_create(&src->reader, NULL, reader_thread, src);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (err != 0) {
+        fprintf(stderr, "Error starting reader thread: %s\n", strerror(err));
+        return -1;
+    }
+    src->reader_started = 1;
+    return 0;
+}
+
+int source_open(struct source *src, const char *path, int width, int height, int format) {
+    memset(src, 0, sizeof(*src));
+    src->fd = src->stop_fd = -1;
+    src->width = width;
+    src->height = height;
+    src->format = format;
+
+    src->fd = strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY | O_CLOEXEC);
+    if (src->fd == -1) {
+        perror("Error opening input");
+        return -1;
+    }
+    struct stat st;
+    if (fstat(src->fd, &st) != 0) {
+        perror("Error reading input");
+        return -1;
+    }
+    return S_ISREG(st.st_mode) ? open_file(src, st.st_size) : open_stream(src);
+}
+
+const uint8_t *source_frame(struct source *src, long n) {
+    if (src->streaming) {
+        src->current = frameq_next(&src->queue);
+        return src->current != NULL ? src->current->surface.pixels : NULL;
+    }
+
+    if (n >= src->frames) return NULL;
+    if (n < src->advised - SOURCE_READAHEAD) src->advised = n;  // Looped back to the start
+    long want = n + SOURCE_READAHEAD < src->frames ? n + SOURCE_READAHEAD : src->frames;
+    if (want > src->advised) {
+        // Page-aligned start of the first frame not yet asked for, to the end of `want`
+        size_t page = sysconf(_SC_PAGESIZE);
+        size_t from = (src->data_offset + src->advised * src->frame_bytes) & ~(page - 1);
+        size_t to = src->data_offset + want * src->frame_bytes;
+        madvise((void *)(src->map + from), to - from, MADV_WILLNEED);
+        src->advised = want;
+    }
+    return src->map + src->data_offset + n * src->frame_bytes;
+}
+
+void source_release(struct source *src) {
+    if (src->current == NULL) return;
+    frameq_release(&src->queue, src->current);
+    src->current = NULL;
+}
+
+void source_interrupt(struct source *src) {
+    if (src->stop_fd == -1) return;
+    uint64_t one = 1;
+    ssize_t n = write(src->stop_fd, &one, sizeof(one));  // Nothing a signal handler could do if it fails
+    (void)n;
+}
+
+void source_close(struct source *src) {
+    if (src->reader_started) {
+        uint64_t one = 1;
+        if (write(src->stop_fd, &one, sizeof(one)) != sizeof(one)) perror("Error stopping reader");
+        frameq_close(&src->queue);
+        pthread_join(src->reader, NULL);
+    }
+    if (src->streaming) {
+        for (int i = 0; i < SOURCE_RING; i++) {
+            if (src->ring[i].surface.block != NULL) surface_free(&src->pool, &src->ring[i].surface);
+        }
+        surface_pool_destroy(&src->pool);
+    }
+    if (src->stop_fd != -1) close(src->stop_fd);
+    if (src->map != NULL) munmap((void *)src->map, src->map_bytes);
+    if (src->fd > STDIN_FILENO) close(src->fd);
+}
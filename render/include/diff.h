@@ -0,0 +1,45 @@
+// include/diff.h
+#ifndef DIFF_H
+#define DIFF_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Content-diff flush. The last frame sent to the device is kept in cached
+// RAM, and each new frame is compared against it one 64-byte chunk at a
+// time with SIMD. Only the runs of changed chunks in each row are written
+// to the device. Nothing has to track damage: a full redraw that changes
+// ten pixels costs ten pixels' worth of cache lines on the device.
+
+#define DIFF_CHUNK 64
+
+struct diff {
+    uint8_t *previous;      // Rows as last presented, stride bytes apart
+    size_t row_bytes;
+    size_t stride;
+    int rows;
+    int valid;              // previous is what the device shows
+    int *runs;              // Byte ranges [runs[2i], runs[2i+1]) changed in the last diff_row()
+    uint64_t frames;
+    uint64_t bytes_written; // Device bytes actually written, all frames
+    uint64_t bytes_full;    // What full copies would have written
+    uint64_t runs_written;
+};
+
+// rows of row_bytes each; returns -1 if out of memory
+int diff_init(struct diff *diff, size_t row_bytes, int rows);
+void diff_free(struct diff *diff);
+// The device no longer shows the last frame (another VT drew on it):
+// the next frame goes out in full
+void diff_invalidate(struct diff *diff);
+
+// Compare row y of a new frame against the last one and remember it;
+// returns the number of changed runs, left in diff->runs
+int diff_row(struct diff *diff, int y, const uint8_t *row);
+// Count one presented frame
+void diff_end_frame(struct diff *diff, size_t written, size_t full);
+
+void diff_report(const struct diff *diff, const char *name, FILE *out);
+
+#endif
@@ -0,0 +1,98 @@
+// include/evloop.h
+#ifndef EVLOOP_H
+#define EVLOOP_H
+
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/input.h>
+
+// One epoll loop per program: timerfds, key input and signals. Nothing is
+// drawn until a handler sets loop->dirty, so an idle program sleeps in
+// epoll_wait without waking up.
+//
+// Key input comes from $FB_INPUT when set (an evdev node, or a FIFO where
+// each byte is a key: space, p, r, q, + and -), otherwise from every
+// readable /dev/input/event* device. Keys are reported as KEY_* codes.
+// SIGINT, SIGTERM and SIGHUP stop the loop so main() can unmap and exit.
+// While loop->suspended is set (our VT is hidden) keys typed on the other
+// console are drained and dropped, and redraws wait until it is cleared.
+
+#define EVLOOP_MAX_SOURCES 32
+#define EVLOOP_MAX_SIGNALS 8
+
+struct evloop;
+
+typedef void (*evloop_timer_fn)(struct evloop *loop, uint64_t expirations, void *ctx);
+typedef void (*evloop_key_fn)(struct evloop *loop, int key, void *ctx);
+typedef void (*evloop_signal_fn)(struct evloop *loop, int signo, void *ctx);
+typedef void (*evloop_redraw_fn)(void *ctx);
+
+struct evloop_source {
+    int fd;
+    int kind;
+    int align;
+    evloop_timer_fn on_timer;
+    evloop_key_fn on_key;
+    void *ctx;
+};
+
+struct evloop_signal {
+    int signo;
+    evloop_signal_fn fn;
+    void *ctx;
+};
+
+struct evloop {
+    int epfd;
+    int sigfd;
+    int running;
+    int dirty;      // Set by handlers to request a redraw
+    int suspended;  // No redraws or keys while set; a pending redraw stays pending
+    int nsources;
+    struct evloop_source sources[EVLOOP_MAX_SOURCES];
+    sigset_t sigmask;
+    int nsignals;
+    struct evloop_signal signals[EVLOOP_MAX_SIGNALS];
+};
+
+int evloop_init(struct evloop *loop);
+void evloop_close(struct evloop *loop);
+
+// Periodic timer. With align set, the first expiry lands on the next whole
+// wall-clock second (use a 1 s interval for clocks). Returns a timer id.
+int evloop_add_timer(struct evloop *loop, long interval_ns, int align, evloop_timer_fn fn, void *ctx);
+// Change a timer's period; 0 disarms it
+int evloop_set_timer(struct evloop *loop, int timer, long interval_ns);
+
+// Open the key input sources; returns how many were opened
+int evloop_add_input(struct evloop *loop, evloop_key_fn fn, void *ctx);
+
+// Route a signal to a handler instead of its default action
+int evloop_on_signal(struct evloop *loop, int signo, evloop_signal_fn fn, void *ctx);
+
+// Dispatch events until loop->running is cleared, redrawing when dirty
+void evloop_run(struct evloop *loop, evloop_redraw_fn redraw, void *ctx);
+
+// Adaptive refresh for a periodic timer. Callers describe what the next
+// frame would show with a small key; while the key stays the same the timer
+// period doubles up to max_ns, and it snaps back to base_ns on any change.
+struct evloop_pacer {
+    int timer;
+    long base_ns;
+    long max_ns;
+    long current_ns;
+    uint64_t last_key;
+    int have_key;
+};
+
+void evloop_pacer_init(struct evloop_pacer *pacer, int timer, long base_ns, long max_ns);
+// Returns 1 when the frame changed and should be drawn
+int evloop_pacer_update(struct evloop *loop, struct evloop_pacer *pacer, const void *key, size_t len);
+// Back to the base rate and forget the last key, e.g. after input or a repaint
+void evloop_pacer_reset(struct evloop *loop, struct evloop_pacer *pacer);
+// Change the base rate, e.g. a slower one while nobody is at the keys. It
+// applies from the next reset, so a stopped timer stays stopped.
+void evloop_pacer_set_base(struct evloop_pacer *pacer, long base_ns);
+
+#endif
@@ -0,0 +1,47 @@
+// include/palette.h
+#ifndef PALETTE_H
+#define PALETTE_H
+
+#include <stdint.h>
+#include <linux/fb.h>
+
+// 8-bit palette-indexed drawing. Surfaces hold one byte per pixel, an index
+// into a 256-entry palette. On a pseudocolor device (8 bpp, FB_VISUAL_PSEUDOCOLOR)
+// the surface is the device memory itself and the palette is the device's
+// colormap, loaded with FBIOPUTCMAP. Changing a few entries recolours every
+// pixel that uses them without writing a pixel. On a truecolor device the
+// surface lives in RAM and is expanded to 32-bit xRGB through a lookup
+// table as it is copied out.
+
+struct palette {
+    uint16_t red[256];          // 16-bit channels, as the colormap ioctls take them
+    uint16_t green[256];
+    uint16_t blue[256];
+    uint32_t lut[256];          // The same colours as xRGB, for expansion
+    int pseudocolor;            // The device takes indices and this palette directly
+    int dirty_lo, dirty_hi;     // Entries changed since the last commit; lo > hi when clean
+    int saved;                  // The device's own colormap was read and must go back
+    uint16_t saved_red[256], saved_green[256], saved_blue[256];
+};
+
+// Detect the device's visual and save its colormap if it has one
+void palette_open(struct palette *pal, int fd, struct fb_var_screeninfo vinfo, struct fb_fix_screeninfo finfo);
+// Put the saved colormap back
+void palette_restore(struct palette *pal, int fd);
+
+void palette_set(struct palette *pal, int index, uint32_t rgb);
+// count entries from `from` to `to`, linearly interpolated
+void palette_ramp(struct palette *pal, int first, int count, uint32_t from, uint32_t to);
+// Mark every entry for the next commit: the first load, or after another
+// VT has changed the colormap
+void palette_touch_all(struct palette *pal);
+// Load the entries changed since the last commit into the device's colormap
+// (pseudocolor only); returns the number of entries that changed
+int palette_commit(struct palette *pal, int fd);
+
+// Truecolor output: one xRGB pixel per index
+void palette_expand(uint32_t *dst, const uint8_t *src, int count, const uint32_t *lut);
+// The same for scattered pixels: dst[offsets[i]] = lut[src[offsets[i]]]
+void palette_expand_pixels(uint32_t *dst, const uint8_t *src, const int *offsets, int count, const uint32_t *lut);
+
+#endif
@@ -0,0 +1,29 @@
+// include/rotate.h
+#ifndef ROTATE_H
+#define ROTATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Output rotation for panels mounted sideways or upside down. The frame is
+// drawn upright at the rotated size and turned clockwise by 90, 180 or 270
+// degrees as it is presented (the same sense as fbcon's rotate=1..3).
+//
+// 90 and 270 are transposes done in ROTATE_TILE x ROTATE_TILE pixel tiles,
+// so a tile's source and destination lines all stay in L1. Within a tile,
+// 4x4 blocks are turned in SSE2/NEON registers, four at a time, so each
+// 64-byte destination line is filled by back-to-back streaming stores,
+// which keeps write-combining happy on a device mapping. 180 reverses each
+// row with vector shuffles.
+
+#define ROTATE_TILE 32  // A multiple of 16; 32 measured fastest for 1080p
+
+// Accepts 0, 90, 180 or 270; -1 for anything else
+int rotate_parse(const char *arg);
+// Turn a width x height frame of `bytes`-per-pixel pixels (1 to 4; 32-bit
+// pixels take the SIMD paths, others a plain loop; strides in bytes) by
+// `rotation`. The result is height x width for 90 and 270.
+void rotate_frame(uint8_t *dst, size_t dst_stride, const uint8_t *src, size_t src_stride,
+                  int width, int height, int bytes, int rotation);
+
+#endif
@@ -0,0 +1,119 @@
+#include "../include/diff.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+int diff_init(struct diff *diff, size_t row_bytes, int rows) {
+    memset(diff, 0, sizeof(*diff));
+    diff->row_bytes = row_bytes;
+    diff->stride = (row_bytes + DIFF_CHUNK - 1) & ~(size_t)(DIFF_CHUNK - 1);
+    diff->rows = rows;
+    diff->previous = aligned_alloc(DIFF_CHUNK, diff->stride * rows);
+    // At worst every other chunk changed, plus the partial chunk at the end
+    diff->runs = malloc(sizeof(int) * 2 * (diff->stride / DIFF_CHUNK / 2 + 2));
+    if (diff->previous == NULL || diff->runs == NULL) {
+        diff_free(diff);
+        return -1;
+    }
+    return 0;
+}
+
+void diff_free(struct diff *diff) {
+    free(diff->previous);
+    free(diff->runs);
+    diff->previous = NULL;
+    diff->runs = NULL;
+}
+
+void diff_invalidate(struct diff *diff) {
+    diff->valid = 0;
+}
+
+// Nonzero if the 64 bytes at a and b differ: XOR the four vector pairs,
+// OR the results and test for zero once
+static inline int chunk_differs(const uint8_t *a, const uint8_t *b) {
+#if defined(__x86_64__) || defined(__i386__)
+    __m128i x0 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)a), _mm_load_si128((const __m128i *)b));
+    __m128i x1 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(a + 16)), _mm_load_si128((const __m128i *)(b + 16)));
+    __m128i x2 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(a + 32)), _mm_load_si128((const __m128i *)(b + 32)));
+    __m128i x3 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(a + 48)), _mm_load_si128((const __m128i *)(b + 48)));
+    __m128i x = _mm_or_si128(_mm_or_si128(x0, x1), _mm_or_si128(x2, x3));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_setzero_si128())) != 0xFFFF;
+#elif defined(__ARM_NEON)
+    uint8x16_t x0 = veorq_u8(vld1q_u8(a), vld1q_u8(b));
+    uint8x16_t x1 = veorq_u8(vld1q_u8(a + 16), vld1q_u8(b + 16));
+    uint8x16_t x2 = veorq_u8(vld1q_u8(a + 32), vld1q_u8(b + 32));
+    uint8x16_t x3 = veorq_u8(vld1q_u8(a + 48), vld1q_u8(b + 48));
+    uint64x2_t x = vreinterpretq_u64_u8(vorrq_u8(vorrq_u8(x0, x1), vorrq_u8(x2, x3)));
+    return (vgetq_lane_u64(x, 0) | vgetq_lane_u64(x, 1)) != 0;
+#else
+    return memcmp(a, b, DIFF_CHUNK) != 0;
+#endif
+}
+
+int diff_row(struct diff *diff, int y, const uint8_t *row) {
+    uint8_t *prev = diff->previous + (size_t)y * diff->stride;
+    size_t full = diff->row_bytes & ~(size_t)(DIFF_CHUNK - 1);
+    int *runs = diff->runs;
+    int n = 0;
+
+    if (!diff->valid) {
+        memcpy(prev, row, diff->row_bytes);
+        runs[0] = 0;
+        runs[1] = diff->row_bytes;
+        diff->runs_written++;
+        return 1;
+    }
+
+    // Adjacent changed chunks coalesce into one run; each run is copied
+    // into the reference while its lines are still in cache
+    size_t x = 0;
+    while (x < full) {
+        if (!chunk_differs(row + x, prev + x)) {
+            x += DIFF_CHUNK;
+            continue;
+        }
+        size_t start = x;
+        do {
+            x += DIFF_CHUNK;
+        } while (x < full && chunk_differs(row + x, prev + x));
+        memcpy(prev + start, row + start, x - start);
+        runs[2 * n] = start;
+        runs[2 * n + 1] = x;
+        n++;
+    }
+    size_t tail = diff->row_bytes - full;
+    if (tail > 0 && memcmp(row + full, prev + full, tail) != 0) {
+        memcpy(prev + full, row + full, tail);
+        if (n > 0 && runs[2 * n - 1] == (int)full) {
+            runs[2 * n - 1] = diff->row_bytes;
+        } else {
+            runs[2 * n] = full;
+            runs[2 * n + 1] = diff->row_bytes;
+            n++;
+        }
+    }
+    diff->runs_written += n;
+    return n;
+}
+
+void diff_end_frame(struct diff *diff, size_t written, size_t full) {
+    diff->valid = 1;
+    diff->frames++;
+    diff->bytes_written += written;
+    diff->bytes_full += full;
+}
+
+void diff_report(const struct diff *diff, const char *name, FILE *out) {
+    if (diff->frames == 0) return;
+    fprintf(out, "%s: %llu frames, %llu bytes written per frame of %llu (%.1f%%), %.1f runs per frame\n", name,
+            (unsigned long long)diff->frames, (unsigned long long)(diff->bytes_written / diff->frames),
+            (unsigned long long)(diff->bytes_full / diff->frames),
+            diff->bytes_full ? 100.0 * diff->bytes_written / diff->bytes_full : 0.0,
+            (double)diff->runs_written / diff->frames);
+}
@@ -0,0 +1,146 @@
+#include "../include/frameq.h"
+#include "../include/profile.h"
+#include <limits.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void futex_wait(uint32_t *addr, uint32_t seen) {
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
+}
+
+static void futex_wake(uint32_t *addr) {
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+// Let a sleeping consumer recheck; only a syscall if one may be asleep
+static void ring_signal(struct frame_ring *ring) {
+    __atomic_fetch_add(&ring->wakeups, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->waiting, __ATOMIC_SEQ_CST)) futex_wake(&ring->wakeups);
+}
+
+// Producer side. Never full: a ring holds every buffer there is.
+static void ring_push(struct frame_ring *ring, struct frame *frame) {
+    uint32_t tail = ring->tail;
+    ring->slots[tail % FRAMEQ_MAX] = frame;
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    ring_signal(ring);
+}
+
+// Consumer side; NULL if empty
+static struct frame *ring_pop(struct frame_ring *ring) {
+    uint32_t head = ring->head;
+    if (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == head) return NULL;
+    struct frame *frame = ring->slots[head % FRAMEQ_MAX];
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return frame;
+}
+
+// Consumer side: sleep until something is pushed or the queue closes. The
+// wakeup count is read before the last look at the ring, so a push or close
+// after that look changes it and the futex wait returns at once.
+static struct frame *ring_wait(struct frameq *q, struct frame_ring *ring) {
+    for (;;) {
+        struct frame *frame = ring_pop(ring);
+        if (frame != NULL) return frame;
+        uint32_t seen = __atomic_load_n(&ring->wakeups, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&ring->waiting, 1, __ATOMIC_SEQ_CST);
+        frame = ring_pop(ring);
+        if (frame == NULL && !__atomic_load_n(&q->closed, __ATOMIC_SEQ_CST)) {
+            futex_wait(&ring->wakeups, seen);
+        }
+        __atomic_store_n(&ring->waiting, 0, __ATOMIC_RELAXED);
+        if (frame != NULL) return frame;
+        if (__atomic_load_n(&q->closed, __ATOMIC_ACQUIRE)) return ring_pop(ring);
+    }
+}
+
+void frameq_init(struct frameq *q, struct frame *frames, int count, int policy) {
+    memset(q, 0, sizeof(*q));
+    q->policy = policy;
+    q->count = count < FRAMEQ_MAX ? count : FRAMEQ_MAX;
+    for (int i = 0; i < q->count; i++) {
+        ring_push(&q->free, &frames[i]);
+    }
+}
+
+void frameq_close(struct frameq *q) {
+    __atomic_store_n(&q->closed, 1, __ATOMIC_SEQ_CST);
+    ring_signal(&q->ready);
+    ring_signal(&q->free);
+}
+
+struct frame *frameq_acquire(struct frameq *q) {
+    struct frame *frame = ring_pop(&q->free);
+    if (frame != NULL) return frame;
+    if (q->policy == FRAMEQ_DROP) {
+        q->stats.dropped++;
+        PROF_COUNT(PROF_FRAMES_DROPPED, 1);
+        return NULL;
+    }
+    q->stats.blocked++;
+    return ring_wait(q, &q->free);
+}
+
+void frameq_submit(struct frameq *q, struct frame *frame) {
+    frame->submitted_ns = now_ns();
+    frame->seq = q->stats.submitted++;
+    ring_push(&q->ready, frame);
+}
+
+// Same sleep as ring_wait(), on the free ring filling up instead of a pop
+void frameq_drain(struct frameq *q) {
+    struct frame_ring *ring = &q->free;
+    for (;;) {
+        uint32_t seen = __atomic_load_n(&ring->wakeups, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&ring->waiting, 1, __ATOMIC_SEQ_CST);
+        int idle = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) - ring->head == (uint32_t)q->count;
+        int closed = __atomic_load_n(&q->closed, __ATOMIC_SEQ_CST);
+        if (!idle && !closed) futex_wait(&ring->wakeups, seen);
+        __atomic_store_n(&ring->waiting, 0, __ATOMIC_RELAXED);
+        if (idle || closed) return;
+    }
+}
+
+struct frame *frameq_next(struct frameq *q) {
+    struct frame *frame = ring_wait(q, &q->ready);
+    if (frame != NULL) {
+        // What was still waiting behind this frame
+        uint32_t depth = __atomic_load_n(&q->ready.tail, __ATOMIC_ACQUIRE) - q->ready.head;
+        q->stats.depth_hist[depth < FRAMEQ_MAX ? depth : FRAMEQ_MAX]++;
+        PROF_COUNT(PROF_QUEUE_DEPTH, depth);
+    }
+    return frame;
+}
+
+void frameq_release(struct frameq *q, struct frame *frame) {
+    uint64_t latency = now_ns() - frame->submitted_ns;
+    q->stats.presented++;
+    q->stats.latency_ns += latency;
+    if (latency > q->stats.latency_max_ns) q->stats.latency_max_ns = latency;
+    PROF_COUNT(PROF_LATENCY_NS, latency);
+    ring_push(&q->free, frame);
+}
+
+void frameq_report(const struct frameq *q, FILE *out) {
+    const struct frameq_stats *s = &q->stats;
+    fprintf(out, "frame queue (%s): %lu submitted, %lu presented, %lu dropped, %lu waits for a buffer\n",
+            q->policy == FRAMEQ_DROP ? "drop" : "block", s->submitted, s->presented, s->dropped, s->blocked);
+    if (s->presented > 0) {
+        fprintf(out, "  latency: %.2f ms average, %.2f ms worst\n",
+                s->latency_ns / 1e6 / s->presented, s->latency_max_ns / 1e6);
+    }
+    fprintf(out, "  frames waiting behind each one presented:");
+    for (int i = 0; i <= FRAMEQ_MAX; i++) {
+        if (s->depth_hist[i] > 0) fprintf(out, " %d:%lu", i, s->depth_hist[i]);
+    }
+    fprintf(out, "\n");
+}
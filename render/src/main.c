@@ -1,15 +1,30 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <signal.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <linux/fb.h>
 #include <math.h>
 #include <stdint.h>
+#include <pthread.h>
+#include "../include/profile.h"
+#include "../include/fixed.h"
+#include "../include/surface.h"
+#include "../include/frameq.h"
+#include "../include/palette.h"
+#include "../include/diff.h"
+#include "../include/rotate.h"
+#include "../include/evloop.h"
+#include "../include/vt.h"
 
 #define CUBE_SIZE 200.0
 #define COLOR 0xFFFFFF  // White for 32-bit or RGB565 for 16-bit
-#define FRAME_DELAY 50000  // Slower: Microseconds (~20fps)
+#define COLOR_INDEX 1   // Palette entry holding COLOR on 8-bit pseudocolor devices
+#define FRAME_INTERVAL_NS 50000000L  // Slower: ~20fps
+#define IDLE_INTERVAL_NS 800000000L  // Back off to 16 frame periods while the picture stays the same
 #define ROTATION_SPEED 0.003  // Slower rotation speed
 
 // Structure for framebuffer info
@@ -19,23 +34,42 @@ struct framebuffer_info {
     struct fb_var_screeninfo vinfo;
     struct fb_fix_screeninfo finfo;
     long int screensize;
+    struct surface back;  // Off-screen frame in cached RAM, copied to fb_ptr once drawn
+    struct palette palette;  // Colormap of an 8-bit pseudocolor device
+    struct diff* diff;    // Last presented frame, to write only what changed; NULL copies every row
+    int rotation;         // 0, 90, 180 or 270 degrees clockwise; frames are drawn upright
+    struct surface turned;  // With a diff and a rotation: the frame as the device has it
 };
 
+// Coordinates and angles are Q16.16 / binary angles in the fixed-point build
+#ifdef FB_FIXED_POINT
+typedef fixed_t coord_t;
+typedef fx_angle_t angle_t;
+#define COORD(f) FX_CONST(f)
+#define ANGLE(r) FX_RAD(r)
+#else
+typedef float coord_t;
+typedef float angle_t;
+#define COORD(f) (f)
+#define ANGLE(r) (r)
+#endif
+#define CUBE_EXTENT COORD(CUBE_SIZE)
+
 // Structure for 3D point
 typedef struct {
-    float x, y, z;
+    coord_t x, y, z;
 } Point3D;
 
 // Cube vertices
 Point3D cube[8] = {
-    {-CUBE_SIZE, -CUBE_SIZE, -CUBE_SIZE},
-    { CUBE_SIZE, -CUBE_SIZE, -CUBE_SIZE},
-    { CUBE_SIZE,  CUBE_SIZE, -CUBE_SIZE},
-    {-CUBE_SIZE,  CUBE_SIZE, -CUBE_SIZE},
-    {-CUBE_SIZE, -CUBE_SIZE,  CUBE_SIZE},
-    { CUBE_SIZE, -CUBE_SIZE,  CUBE_SIZE},
-    { CUBE_SIZE,  CUBE_SIZE,  CUBE_SIZE},
-    {-CUBE_SIZE,  CUBE_SIZE,  CUBE_SIZE}
+    {-CUBE_EXTENT, -CUBE_EXTENT, -CUBE_EXTENT},
+    { CUBE_EXTENT, -CUBE_EXTENT, -CUBE_EXTENT},
+    { CUBE_EXTENT,  CUBE_EXTENT, -CUBE_EXTENT},
+    {-CUBE_EXTENT,  CUBE_EXTENT, -CUBE_EXTENT},
+    {-CUBE_EXTENT, -CUBE_EXTENT,  CUBE_EXTENT},
+    { CUBE_EXTENT, -CUBE_EXTENT,  CUBE_EXTENT},
+    { CUBE_EXTENT,  CUBE_EXTENT,  CUBE_EXTENT},
+    {-CUBE_EXTENT,  CUBE_EXTENT,  CUBE_EXTENT}
 };
 
 // Cube edges
@@ -45,10 +79,14 @@ int edges[12][2] = {
     {0, 4}, {1, 5}, {2, 6}, {3, 7}   // Connecting edges
 };
 
-// Function to initialize framebuffer
-struct framebuffer_info init_framebuffer(const char* fb_path) {
+// Function to initialize framebuffer; the back buffer comes from `pool`,
+// upright for `rotation` (yres x xres for 90 and 270)
+struct framebuffer_info init_framebuffer(const char* fb_path, struct surface_pool* pool, int rotation) {
     struct framebuffer_info fb_info;
     
+    fb_info.diff = NULL;
+    fb_info.rotation = rotation;
+    memset(&fb_info.turned, 0, sizeof(fb_info.turned));
     fb_info.fb_fd = open(fb_path, O_RDWR);
     if (fb_info.fb_fd == -1) {
         perror("Error opening framebuffer device");
@@ -77,31 +115,94 @@ struct framebuffer_info init_framebuffer(const char* fb_path) {
         exit(1);
     }
 
+    int sideways = rotation == 90 || rotation == 270;
+    int width = sideways ? fb_info.vinfo.yres : fb_info.vinfo.xres;
+    int height = sideways ? fb_info.vinfo.xres : fb_info.vinfo.yres;
+    if (surface_alloc(pool, &fb_info.back, width, height, fb_info.vinfo.bits_per_pixel / 8) != 0) {
+        exit(1);
+    }
+
+    // An 8-bit device draws palette indices, so load the two colours used
+    palette_open(&fb_info.palette, fb_info.fb_fd, fb_info.vinfo, fb_info.finfo);
+    if (fb_info.palette.pseudocolor) {
+        palette_set(&fb_info.palette, COLOR_INDEX, COLOR);
+        palette_touch_all(&fb_info.palette);
+        palette_commit(&fb_info.palette, fb_info.fb_fd);
+    }
+
     return fb_info;
 }
 
 // Function to clear the screen
 void clear_screen(struct framebuffer_info* fb_info) {
-    for (int i = 0; i < fb_info->screensize; i++) {
-        fb_info->fb_ptr[i] = 0;  // Set each pixel to black
+    memset(fb_info->back.pixels, 0, fb_info->back.stride * fb_info->back.height);  // Set each pixel to black
+    PROF_COUNT(PROF_PIXELS, fb_info->back.width * fb_info->back.height);
+}
+
+// Copy the visible rows of a finished frame to the device; with a diff,
+// only the runs of each row that changed since the last frame. A rotated
+// frame is turned straight into the device, or into fb_info->turned first
+// so the diff sees it as the device will.
+void present_surface(const struct framebuffer_info* fb_info, const struct surface* frame) {
+    PROF_BEGIN(PROF_FLUSH);
+    if (fb_info->rotation != 0) {
+        const struct surface* out = fb_info->diff != NULL ? &fb_info->turned : NULL;
+        uint8_t* origin = fb_info->fb_ptr + fb_info->vinfo.xoffset * (fb_info->vinfo.bits_per_pixel / 8) +
+                          fb_info->vinfo.yoffset * fb_info->finfo.line_length;
+        rotate_frame(out != NULL ? out->pixels : origin, out != NULL ? out->stride : fb_info->finfo.line_length,
+                     frame->pixels, frame->stride, frame->width, frame->height, frame->bytes_per_pixel, fb_info->rotation);
+        if (out == NULL) {
+            PROF_COUNT(PROF_BYTES_FLUSHED, (size_t)frame->width * frame->height * frame->bytes_per_pixel);
+            PROF_END(PROF_FLUSH);
+            return;
+        }
+        frame = out;
     }
+
+    size_t row_bytes = (size_t)frame->width * frame->bytes_per_pixel;
+    size_t written = 0;
+    for (int y = 0; y < frame->height; y++) {
+        long location = fb_info->vinfo.xoffset * (fb_info->vinfo.bits_per_pixel / 8) +
+                        (y + fb_info->vinfo.yoffset) * fb_info->finfo.line_length;
+        if (fb_info->diff == NULL) {
+            memcpy(fb_info->fb_ptr + location, surface_row(frame, y), row_bytes);
+            written += row_bytes;
+            continue;
+        }
+        int n = diff_row(fb_info->diff, y, surface_row(frame, y));
+        for (int i = 0; i < n; i++) {
+            int from = fb_info->diff->runs[2 * i], to = fb_info->diff->runs[2 * i + 1];
+            memcpy(fb_info->fb_ptr + location + from, surface_row(frame, y) + from, to - from);
+            written += to - from;
+        }
+    }
+    if (fb_info->diff != NULL) diff_end_frame(fb_info->diff, written, row_bytes * frame->height);
+    PROF_COUNT(PROF_BYTES_FLUSHED, written);
+    PROF_END(PROF_FLUSH);
 }
 
-// Function to set a pixel in the framebuffer
+// Copy the visible rows of the back buffer to the device
+void present(struct framebuffer_info* fb_info) {
+    present_surface(fb_info, &fb_info->back);
+}
+
+// Function to set a pixel in the back buffer
 void set_pixel(struct framebuffer_info* fb_info, int x, int y, uint32_t color) {
-    if (x >= 0 && x < fb_info->vinfo.xres && y >= 0 && y < fb_info->vinfo.yres) {
-        long location = (x + fb_info->vinfo.xoffset) * (fb_info->vinfo.bits_per_pixel / 8) +
-                        (y + fb_info->vinfo.yoffset) * fb_info->finfo.line_length;
+    if (x >= 0 && x < fb_info->back.width && y >= 0 && y < fb_info->back.height) {
+        uint8_t* location = surface_row(&fb_info->back, y) + x * fb_info->back.bytes_per_pixel;
 
         // Handle different bits per pixel
         if (fb_info->vinfo.bits_per_pixel == 32) {
-            *((uint32_t*)(fb_info->fb_ptr + location)) = color;
+            *((uint32_t*)location) = color;
         } else if (fb_info->vinfo.bits_per_pixel == 16) {
             uint16_t rgb565 = ((color & 0xF80000) >> 8) | ((color & 0x00FC00) >> 5) | ((color & 0x0000F8) >> 3);
-            *((uint16_t*)(fb_info->fb_ptr + location)) = rgb565;
+            *((uint16_t*)location) = rgb565;
+        } else if (fb_info->palette.pseudocolor) {
+            *location = color ? COLOR_INDEX : 0;
         } else {
             printf("Unsupported bits per pixel: %d\n", fb_info->vinfo.bits_per_pixel);
         }
+        PROF_COUNT(PROF_PIXELS, 1);
     }
 }
 
@@ -111,6 +212,7 @@ void draw_line(struct framebuffer_info* fb_info, int x0, int y0, int x1, int y1,
     int dy = -abs(y1 - y0), sy = y0 < y1 ? 1 : -1;
     int err = dx + dy, e2;
 
+    PROF_COUNT(PROF_LINES, 1);
     while (1) {
         set_pixel(fb_info, x0, y0, color);
         if (x0 == x1 && y0 == y1) break;
@@ -121,8 +223,47 @@ void draw_line(struct framebuffer_info* fb_info, int x0, int y0, int x1, int y1,
     }
 }
 
+#ifdef FB_FIXED_POINT
 // Function to rotate 3D point
-void rotate(Point3D* p, float angleX, float angleY, float angleZ) {
+void rotate(Point3D* p, angle_t angleX, angle_t angleY, angle_t angleZ) {
+    fixed_t cosX = fx_cos(angleX), sinX = fx_sin(angleX);
+    fixed_t cosY = fx_cos(angleY), sinY = fx_sin(angleY);
+    fixed_t cosZ = fx_cos(angleZ), sinZ = fx_sin(angleZ);
+
+    // Rotation around X-axis
+    fixed_t y = fx_mul(p->y, cosX) - fx_mul(p->z, sinX);
+    fixed_t z = fx_mul(p->y, sinX) + fx_mul(p->z, cosX);
+    p->y = y;
+    p->z = z;
+
+    // Rotation around Y-axis
+    fixed_t x = fx_mul(p->x, cosY) + fx_mul(p->z, sinY);
+    z = -fx_mul(p->x, sinY) + fx_mul(p->z, cosY);
+    p->x = x;
+    p->z = z;
+
+    // Rotation around Z-axis
+    x = fx_mul(p->x, cosZ) - fx_mul(p->y, sinZ);
+    y = fx_mul(p->x, sinZ) + fx_mul(p->y, cosZ);
+    p->x = x;
+    p->y = y;
+}
+
+// Function to project 3D point onto 2D screen
+void project(Point3D p, int* x2D, int* y2D, int screenWidth, int screenHeight, coord_t dist) {
+    fixed_t scale = fx_div(dist, p.z + dist);  // Perspective scaling, reciprocal table instead of a divide
+    *x2D = screenWidth / 2 + FX_TO_INT(fx_mul(p.x, scale));
+    *y2D = screenHeight / 2 + FX_TO_INT(fx_mul(p.y, scale));
+
+    // Ensure the projected point remains within screen bounds
+    if (*x2D < 0) *x2D = 0;
+    if (*x2D >= screenWidth) *x2D = screenWidth - 1;
+    if (*y2D < 0) *y2D = 0;
+    if (*y2D >= screenHeight) *y2D = screenHeight - 1;
+}
+#else
+// Function to rotate 3D point
+void rotate(Point3D* p, angle_t angleX, angle_t angleY, angle_t angleZ) {
     // Rotation around X-axis
     float y = p->y * cos(angleX) - p->z * sin(angleX);
     float z = p->y * sin(angleX) + p->z * cos(angleX);
@@ -143,7 +284,7 @@ void rotate(Point3D* p, float angleX, float angleY, float angleZ) {
 }
 
 // Function to project 3D point onto 2D screen
-void project(Point3D p, int* x2D, int* y2D, int screenWidth, int screenHeight, float dist) {
+void project(Point3D p, int* x2D, int* y2D, int screenWidth, int screenHeight, coord_t dist) {
     float scale = dist / (p.z + dist);  // Perspective scaling
     *x2D = (int)(screenWidth / 2 + p.x * scale);
     *y2D = (int)(screenHeight / 2 + p.y * scale);
@@ -154,41 +295,250 @@ void project(Point3D p, int* x2D, int* y2D, int screenWidth, int screenHeight, f
     if (*y2D < 0) *y2D = 0;
     if (*y2D >= screenHeight) *y2D = screenHeight - 1;
 }
+#endif
+
+// Rotate and project each vertex; the frame is a function of these 16 numbers
+void project_cube(const struct framebuffer_info* fb_info, angle_t angleX, angle_t angleY, angle_t angleZ, coord_t dist,
+                  int projected[8][2]) {
+    PROF_BEGIN(PROF_TRANSFORM);
+    for (int i = 0; i < 8; i++) {
+        Point3D transformed = cube[i];
+        rotate(&transformed, angleX, angleY, angleZ);
+        project(transformed, &projected[i][0], &projected[i][1], fb_info->back.width, fb_info->back.height, dist);
+    }
+    PROF_END(PROF_TRANSFORM);
+}
 
-// Main function
-int main() {
-    struct framebuffer_info fb_info = init_framebuffer("/dev/fb0");
+// Draw one frame of the cube into fb_info->back
+void render_cube(struct framebuffer_info* fb_info, int projected[8][2]) {
+    PROF_BEGIN(PROF_CLEAR);
+    clear_screen(fb_info);
+    PROF_END(PROF_CLEAR);
+
+    // Draw the cube edges
+    PROF_BEGIN(PROF_RASTERIZE);
+    for (int i = 0; i < 12; i++) {
+        draw_line(fb_info, projected[edges[i][0]][0], projected[edges[i][0]][1],
+                  projected[edges[i][1]][0], projected[edges[i][1]][1], COLOR);
+    }
+    PROF_END(PROF_RASTERIZE);
+}
 
-    float angleX = 0, angleY = 0, angleZ = 0;
-    float dist = 400.0f;
+struct presenter {
+    const struct framebuffer_info* fb_info;
+    struct frameq* queue;
+};
 
-    while (1) {
-        clear_screen(&fb_info);
+// Present thread: write each finished frame to the device, then hand its buffer back
+static void* present_thread(void* arg) {
+    struct presenter* p = arg;
+    struct frame* frame;
+    while ((frame = frameq_next(p->queue)) != NULL) {
+        PROF_FRAME_BEGIN();
+        present_surface(p->fb_info, &frame->surface);
+        frameq_release(p->queue, frame);
+        PROF_FRAME_END();
+    }
+    return NULL;
+}
 
-        Point3D transformed[8];
-        int projected[8][2];
+// Per-run state shared by the event handlers
+struct render_state {
+    struct framebuffer_info* fb_info;
+    struct frameq* queue;           // Pipeline mode; NULL when this thread writes to the device
+    angle_t angleX, angleY, angleZ;
+    coord_t dist;
+    int projected[8][2];            // Corners of the next frame
+    int frame_timer;
+    struct evloop_pacer pacer;
+};
 
-        // Rotate and project each vertex
-        for (int i = 0; i < 8; i++) {
-            transformed[i] = cube[i];
-            rotate(&transformed[i], angleX, angleY, angleZ);
-            project(transformed[i], &projected[i][0], &projected[i][1], fb_info.vinfo.xres, fb_info.vinfo.yres, dist);
+// Draw the next frame and write it out, or queue it for the present thread
+void render_frame(void* ctx) {
+    struct render_state* st = ctx;
+    PROF_FRAME_BEGIN();
+    if (st->queue != NULL) {
+        // The simulation moves on even when this frame is dropped
+        struct frame* frame = frameq_acquire(st->queue);
+        if (frame != NULL) {
+            st->fb_info->back = frame->surface;
+            render_cube(st->fb_info, st->projected);
+            frameq_submit(st->queue, frame);
         }
+    } else {
+        render_cube(st->fb_info, st->projected);
+        present(st->fb_info);
+    }
+    PROF_FRAME_END();
+}
 
-        // Draw the cube edges
-        for (int i = 0; i < 12; i++) {
-            draw_line(&fb_info, projected[edges[i][0]][0], projected[edges[i][0]][1],
-                      projected[edges[i][1]][0], projected[edges[i][1]][1], COLOR);
+// Turn the cube one step per elapsed frame period. The slow rotation often
+// leaves every corner on the same pixel; the pacer then stretches the timer
+// and each tick covers that many periods instead.
+void on_frame_tick(struct evloop* loop, uint64_t expirations, void* ctx) {
+    struct render_state* st = ctx;
+    uint64_t steps = expirations * (st->pacer.current_ns / FRAME_INTERVAL_NS);
+    for (uint64_t i = 0; i < steps; i++) {
+        // Increment angles for slower rotation
+        st->angleX += ANGLE(ROTATION_SPEED);
+        st->angleY += ANGLE(ROTATION_SPEED * 0.5);
+        st->angleZ += ANGLE(ROTATION_SPEED * 0.25);
+    }
+
+    project_cube(st->fb_info, st->angleX, st->angleY, st->angleZ, st->dist, st->projected);
+    if (evloop_pacer_update(loop, &st->pacer, st->projected, sizeof(st->projected))) loop->dirty = 1;
+}
+
+// Stop the frame timer while another VT is in front. The present thread has
+// to be done with the device before the VT is released. On return the
+// colormap goes back and, with -c, the next frame is written in full: the
+// other console drew over what the diff remembers.
+void on_vt_change(struct evloop* loop, int visible, void* ctx) {
+    struct render_state* st = ctx;
+    if (!visible) {
+        evloop_set_timer(loop, st->frame_timer, 0);
+        if (st->queue != NULL) frameq_drain(st->queue);
+        return;
+    }
+    palette_touch_all(&st->fb_info->palette);
+    palette_commit(&st->fb_info->palette, st->fb_info->fb_fd);
+    if (st->fb_info->diff != NULL) diff_invalidate(st->fb_info->diff);
+    evloop_pacer_reset(loop, &st->pacer);
+    evloop_set_timer(loop, st->frame_timer, st->pacer.base_ns);
+}
+
+// Main function
+// Usage: cube_render [-H] [-n] [-c] [-p depth] [-d] [-R degrees]
+// Draws to $FRAMEBUFFER, or /dev/fb0 when it is not set.
+// -H backs surfaces with hugetlbfs pages when reserved, -n skips pre-faulting.
+// -c compares each frame with the last and writes only what changed.
+// -R turns the picture clockwise by 90, 180 or 270 degrees for a rotated panel.
+// Ctrl-C or SIGTERM stops it; nothing is drawn while another VT is in front.
+// -p draws on this thread and writes to the device from another, through a
+// queue of `depth` frames; -d drops frames instead of waiting when it is full.
+int main(int argc, char* argv[]) {
+    int pool_flags = SURFACE_THP | SURFACE_PREFAULT;
+    int depth = 0;
+    int policy = FRAMEQ_BLOCK;
+    int compare = 0;
+    int rotation = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "Hncp:dR:")) != -1) {
+        switch (opt) {
+            case 'H': pool_flags |= SURFACE_HUGETLB; break;
+            case 'n': pool_flags &= ~SURFACE_PREFAULT; break;
+            case 'c': compare = 1; break;
+            case 'p': {
+                // One buffer being drawn, `depth` queued, one on its way to the device
+                char* end;
+                long n = strtol(optarg, &end, 10);
+                if (end == optarg || *end != '\0' || n < 1 || n + 2 > FRAMEQ_MAX) {
+                    fprintf(stderr, "Error: queue depth must be 1-%d\n", FRAMEQ_MAX - 2);
+                    exit(1);
+                }
+                depth = (int)n;
+                break;
+            }
+            case 'd': policy = FRAMEQ_DROP; break;
+            case 'R':
+                rotation = rotate_parse(optarg);
+                if (rotation < 0) {
+                    fprintf(stderr, "Error: bad rotation '%s' (0, 90, 180 or 270)\n", optarg);
+                    exit(1);
+                }
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-H] [-n] [-c] [-p depth] [-d] [-R degrees]\n", argv[0]);
+                exit(1);
+        }
+    }
+    struct surface_pool pool;
+    surface_pool_init(&pool, pool_flags);
+    const char* fb_path = getenv("FRAMEBUFFER");  // e.g. /dev/fb1, as for other framebuffer programs
+    if (fb_path == NULL) fb_path = "/dev/fb0";
+    struct framebuffer_info fb_info = init_framebuffer(fb_path, &pool, rotation);
+    struct diff diff;
+    if (compare) {
+        // Compared at the device's size, after any rotation
+        if (diff_init(&diff, (size_t)fb_info.vinfo.xres * fb_info.back.bytes_per_pixel, fb_info.vinfo.yres) != 0) {
+            perror("Error allocating diff buffer");
+            exit(1);
         }
+        fb_info.diff = &diff;
+        if (rotation != 0 &&
+            surface_alloc(&pool, &fb_info.turned, fb_info.vinfo.xres, fb_info.vinfo.yres, fb_info.back.bytes_per_pixel) != 0) {
+            exit(1);
+        }
+    }
 
-        // Increment angles for slower rotation
-        angleX += ROTATION_SPEED;
-        angleY += ROTATION_SPEED * 0.5;
-        angleZ += ROTATION_SPEED * 0.25;
+    // ~20 FPS frame timer; returns on SIGINT/SIGTERM so the pool report and
+    // cleanup below run. Set up first: the signals it blocks stay blocked in
+    // the present thread too.
+    struct evloop loop;
+    if (evloop_init(&loop) != 0) exit(1);
+    struct render_state state = { .fb_info = &fb_info, .dist = COORD(400.0f) };
+    state.frame_timer = evloop_add_timer(&loop, FRAME_INTERVAL_NS, 0, on_frame_tick, &state);
+    if (state.frame_timer < 0) exit(1);
+    evloop_pacer_init(&state.pacer, state.frame_timer, FRAME_INTERVAL_NS, IDLE_INTERVAL_NS);
+    project_cube(&fb_info, state.angleX, state.angleY, state.angleZ, state.dist, state.projected);
+
+    PROF_INIT("render");
+
+    // Pipeline mode: the frame buffers come from the same pool as the back buffer
+    struct frame frames[FRAMEQ_MAX];
+    int nframes = depth > 0 ? depth + 2 : 0;
+    struct frameq queue;
+    struct presenter presenter = { &fb_info, &queue };
+    pthread_t present_tid;
+    if (depth > 0) {
+        frames[0].surface = fb_info.back;
+        for (int i = 1; i < nframes; i++) {
+            if (surface_alloc(&pool, &frames[i].surface, fb_info.back.width, fb_info.back.height, fb_info.back.bytes_per_pixel) != 0) {
+                exit(1);
+            }
+        }
+        frameq_init(&queue, frames, nframes, policy);
+        state.queue = &queue;
+
+        // Signals stay with this thread so Ctrl-C ends the render loop
+        sigset_t all, old;
+        sigfillset(&all);
+        pthread_sigmask(SIG_SETMASK, &all, &old);
+        int err = pthread_create(&present_tid, NULL, present_thread, &presenter);
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+        if (err != 0) {
+            fprintf(stderr, "Error starting present thread: %s\n", strerror(err));
+            exit(1);
+        }
+    }
 
-        usleep(FRAME_DELAY);  // Slower frame rate for smoother rotation
+    struct vt_state vt;
+    vt_init(&vt, &loop, on_vt_change, &state);
+    evloop_run(&loop, render_frame, &state);
+    vt_restore(&vt);
+    evloop_close(&loop);
+
+    if (depth > 0) {
+        // Whatever is still queued goes out, then the presenter returns
+        frameq_close(&queue);
+        pthread_join(present_tid, NULL);
+        frameq_report(&queue, stderr);
+        for (int i = 1; i < nframes; i++) {
+            surface_free(&pool, &frames[i].surface);
+        }
+        fb_info.back = frames[0].surface;
     }
 
+    PROF_SHUTDOWN();
+    if (compare) {
+        diff_report(&diff, fb_path, stderr);
+        diff_free(&diff);
+    }
+    if (fb_info.turned.block != NULL) surface_free(&pool, &fb_info.turned);
+    surface_free(&pool, &fb_info.back);
+    surface_pool_report(&pool, stderr);
+    surface_pool_destroy(&pool);
+    palette_restore(&fb_info.palette, fb_info.fb_fd);
     munmap(fb_info.fb_ptr, fb_info.screensize);
     close(fb_info.fb_fd);
     return 0;
@@ -0,0 +1,185 @@
+#include "../include/rotate.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+int rotate_parse(const char *arg) {
+    char *end;
+    long degrees = strtol(arg, &end, 10);
+    if (*end != '\0' || (degrees != 0 && degrees != 90 && degrees != 180 && degrees != 270)) return -1;
+    return degrees;
+}
+
+// Where source pixel (x, y) of a width x height frame lands
+static inline void rotated_xy(int rotation, int width, int height, int x, int y, int *dx, int *dy) {
+    switch (rotation) {
+        case 90: *dx = height - 1 - y; *dy = x; break;
+        case 180: *dx = width - 1 - x; *dy = height - 1 - y; break;
+        case 270: *dx = y; *dy = width - 1 - x; break;
+        default: *dx = x; *dy = y; break;
+    }
+}
+
+// Any pixel size, any part of the frame: tile edges and 16-bit pixels
+static void rotate_rect(uint8_t *dst, size_t dst_stride, const uint8_t *src, size_t src_stride, int width, int height,
+                        int bytes, int rotation, int x0, int y0, int x1, int y1) {
+    for (int y = y0; y < y1; y++) {
+        const uint8_t *in = src + (size_t)y * src_stride;
+        for (int x = x0; x < x1; x++) {
+            int dx, dy;
+            rotated_xy(rotation, width, height, x, y, &dx, &dy);
+            memcpy(dst + (size_t)dy * dst_stride + (size_t)dx * bytes, in + (size_t)x * bytes, bytes);
+        }
+    }
+}
+
+// Turn a 4x4 block of 32-bit pixels: rows in, in + in_step, ... become
+// columns stored at out, out + out_step, ... Negative steps walk upwards.
+// `stream` (a constant at each call) picks aligned streaming stores: the
+// lines are written whole and never read back.
+#if defined(__x86_64__) || defined(__i386__)
+static inline __attribute__((always_inline)) void block4(uint8_t *out, ptrdiff_t out_step, const uint8_t *in,
+                                                         ptrdiff_t in_step, const int stream) {
+    __m128i r0 = _mm_loadu_si128((const __m128i *)in), r1 = _mm_loadu_si128((const __m128i *)(in + in_step));
+    __m128i r2 = _mm_loadu_si128((const __m128i *)(in + 2 * in_step));
+    __m128i r3 = _mm_loadu_si128((const __m128i *)(in + 3 * in_step));
+    __m128i t0 = _mm_unpacklo_epi32(r0, r1), t1 = _mm_unpacklo_epi32(r2, r3);
+    __m128i t2 = _mm_unpackhi_epi32(r0, r1), t3 = _mm_unpackhi_epi32(r2, r3);
+    __m128i c0 = _mm_unpacklo_epi64(t0, t1), c1 = _mm_unpackhi_epi64(t0, t1);
+    __m128i c2 = _mm_unpacklo_epi64(t2, t3), c3 = _mm_unpackhi_epi64(t2, t3);
+    if (stream) {
+        _mm_stream_si128((__m128i *)out, c0);
+        _mm_stream_si128((__m128i *)(out + out_step), c1);
+        _mm_stream_si128((__m128i *)(out + 2 * out_step), c2);
+        _mm_stream_si128((__m128i *)(out + 3 * out_step), c3);
+    } else {
+        _mm_storeu_si128((__m128i *)out, c0);
+        _mm_storeu_si128((__m128i *)(out + out_step), c1);
+        _mm_storeu_si128((__m128i *)(out + 2 * out_step), c2);
+        _mm_storeu_si128((__m128i *)(out + 3 * out_step), c3);
+    }
+}
+#elif defined(__ARM_NEON)
+static inline __attribute__((always_inline)) void block4(uint8_t *out, ptrdiff_t out_step, const uint8_t *in,
+                                                         ptrdiff_t in_step, const int stream) {
+    uint32x4x2_t a = vtrnq_u32(vld1q_u32((const uint32_t *)in), vld1q_u32((const uint32_t *)(in + in_step)));
+    uint32x4x2_t b = vtrnq_u32(vld1q_u32((const uint32_t *)(in + 2 * in_step)),
+                               vld1q_u32((const uint32_t *)(in + 3 * in_step)));
+    vst1q_u32((uint32_t *)out, vcombine_u32(vget_low_u32(a.val[0]), vget_low_u32(b.val[0])));
+    vst1q_u32((uint32_t *)(out + out_step), vcombine_u32(vget_low_u32(a.val[1]), vget_low_u32(b.val[1])));
+    vst1q_u32((uint32_t *)(out + 2 * out_step), vcombine_u32(vget_high_u32(a.val[0]), vget_high_u32(b.val[0])));
+    vst1q_u32((uint32_t *)(out + 3 * out_step), vcombine_u32(vget_high_u32(a.val[1]), vget_high_u32(b.val[1])));
+}
+#else
+static inline void block4(uint8_t *out, ptrdiff_t out_step, const uint8_t *in, ptrdiff_t in_step, const int stream) {
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) memcpy(out + i * out_step + j * 4, in + j * in_step + i * 4, 4);
+    }
+}
+#endif
+
+// Source columns x..x+3 of rows y..y+15 (32-bit pixels, 90 or 270). These
+// become 4 destination lines of 16 pixels, one cache line each when the
+// destination column is 16-pixel aligned.
+//   90: column x+i is dst row x+i, read upwards; row y+15 lands leftmost.
+//   270: column x+i is dst row width-1-x-i, read downwards; row y leftmost.
+static inline __attribute__((always_inline)) void rotate_strip(uint8_t *dst, size_t dst_stride, const uint8_t *src,
+                                                               size_t src_stride, int width, int height, const int rotation,
+                                                               const int stream, int x, int y) {
+    const uint8_t *in = src + (size_t)y * src_stride + (size_t)x * 4;
+    if (rotation == 90) {
+        uint8_t *out = dst + (size_t)x * dst_stride + (size_t)(height - y - 16) * 4;
+        in += 15 * src_stride;
+        for (int b = 0; b < 4; b++, in -= 4 * src_stride, out += 16) {
+            block4(out, dst_stride, in, -(ptrdiff_t)src_stride, stream);
+        }
+    } else {
+        uint8_t *out = dst + (size_t)(width - 1 - x) * dst_stride + (size_t)y * 4;
+        for (int b = 0; b < 4; b++, in += 4 * src_stride, out += 16) {
+            block4(out, -(ptrdiff_t)dst_stride, in, src_stride, stream);
+        }
+    }
+}
+
+// Reverse one row of 32-bit pixels
+static void reverse_row(uint32_t *dst, const uint32_t *src, int count) {
+    int x = 0;
+#if defined(__x86_64__) || defined(__i386__)
+    for (; x + 4 <= count; x += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + x));
+        _mm_storeu_si128((__m128i *)(dst + count - 4 - x), _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3)));
+    }
+#elif defined(__ARM_NEON)
+    for (; x + 4 <= count; x += 4) {
+        uint32x4_t v = vrev64q_u32(vld1q_u32(src + x));
+        vst1q_u32(dst + count - 4 - x, vcombine_u32(vget_high_u32(v), vget_low_u32(v)));
+    }
+#endif
+    for (; x < count; x++) dst[count - 1 - x] = src[x];
+}
+
+// 90 or 270 for 32-bit pixels. The strips cover 16-row bands placed so that
+// every band starts on a 16-pixel destination column: from the bottom for
+// 90, the top for 270. They are walked in tiles of ROTATE_TILE x ROTATE_TILE
+// source pixels.
+static inline __attribute__((always_inline)) void rotate_bands(uint8_t *dst, size_t dst_stride, const uint8_t *src, size_t src_stride,
+                                int width, int height, const int rotation, const int stream) {
+    int full_w = width & ~3, bands = height & ~15;
+    int band_y = rotation == 90 ? height - bands : 0;
+    for (int ty = band_y; ty < band_y + bands; ty += ROTATE_TILE) {
+        int ty_end = ty + ROTATE_TILE < band_y + bands ? ty + ROTATE_TILE : band_y + bands;
+        for (int tx = 0; tx < full_w; tx += ROTATE_TILE) {
+            int tx_end = tx + ROTATE_TILE < full_w ? tx + ROTATE_TILE : full_w;
+            for (int x = tx; x < tx_end; x += 4) {
+                for (int y = ty; y < ty_end; y += 16) {
+                    rotate_strip(dst, dst_stride, src, src_stride, width, height, rotation, stream, x, y);
+                }
+            }
+        }
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    if (stream) _mm_sfence();  // Streaming stores done before the caller presents or reads back
+#endif
+    // Columns past the last multiple of 4, and rows outside the bands
+    rotate_rect(dst, dst_stride, src, src_stride, width, height, 4, rotation, full_w, 0, width, height);
+    rotate_rect(dst, dst_stride, src, src_stride, width, height, 4, rotation, 0, 0, full_w, band_y);
+    rotate_rect(dst, dst_stride, src, src_stride, width, height, 4, rotation, 0, band_y + bands, full_w, height);
+}
+
+void rotate_frame(uint8_t *dst, size_t dst_stride, const uint8_t *src, size_t src_stride,
+                  int width, int height, int bytes, int rotation) {
+    if (rotation == 0) {
+        for (int y = 0; y < height; y++) {
+            memcpy(dst + (size_t)y * dst_stride, src + (size_t)y * src_stride, (size_t)width * bytes);
+        }
+        return;
+    }
+    if (bytes != 4) {
+        rotate_rect(dst, dst_stride, src, src_stride, width, height, bytes, rotation, 0, 0, width, height);
+        return;
+    }
+    if (rotation == 180) {
+        // Rows are already contiguous on both sides; no tiling needed
+        for (int y = 0; y < height; y++) {
+            reverse_row((uint32_t *)(dst + (size_t)(height - 1 - y) * dst_stride), (const uint32_t *)(src + (size_t)y * src_stride), width);
+        }
+        return;
+    }
+
+    // A copy for each direction and store kind, so the strips compile
+    // without branches. Bands start on 16-pixel columns, so every store is
+    // aligned when the destination and its stride are.
+    int aligned = ((uintptr_t)dst & 15) == 0 && (dst_stride & 15) == 0;
+    if (rotation == 90) {
+        if (aligned) rotate_bands(dst, dst_stride, src, src_stride, width, height, 90, 1);
+        else rotate_bands(dst, dst_stride, src, src_stride, width, height, 90, 0);
+    } else {
+        if (aligned) rotate_bands(dst, dst_stride, src, src_stride, width, height, 270, 1);
+        else rotate_bands(dst, dst_stride, src, src_stride, width, height, 270, 0);
+    }
+}
@@ -1,6 +1,10 @@
 #ifndef CUBE_H
 #define CUBE_H
 
+#include <stdint.h>
+#include <linux/fb.h>
+#include "palette.h"
+
 typedef struct {
     float x, y, z;
 } Vertex;
@@ -9,13 +13,30 @@ typedef struct {
     int width, height;
 } Screen;
 
+// Framebuffer and screen state, defined in cube.c
+extern char *fbp;
+extern struct fb_var_screeninfo vinfo;
+extern struct fb_fix_screeninfo finfo;
+extern Screen screen;
+extern struct palette palette;  // The device's colormap on 8 bpp pseudocolor
+
+// Edge colours, xRGB; on an 8 bpp pseudocolor device each one is drawn as
+// its own colormap entry (CUBE_BLACK is entry 0, the others follow)
+enum { CUBE_BLACK, CUBE_WHITE, CUBE_GREEN, CUBE_RED, CUBE_COLORS };
+extern const unsigned int cube_colors[CUBE_COLORS];
+
+typedef void (*line_fn)(int x1, int y1, int x2, int y2, unsigned int color);
+
 // Function declarations
 void init_framebuffer();
-void draw_cube(Vertex vertices[8], Screen *screen);
+// Write count xRGB pixels to device memory in the device's format
+void store_pixels(char *dst, const uint32_t *src, int count);
+void project_point(Vertex v, float centerX, float centerY, int *x, int *y);
+void draw_cube_edges(const int projectedX[8], const int projectedY[8], line_fn line);
+void draw_cube(Vertex vertices[8]);
 void translate(Vertex *v, float dx, float dy, float dz);
 void rotate_cube(Vertex vertices[8], float angleX, float angleY);
-void update_screen(Screen *screen);
-void handle_collision(Vertex *v, Screen *screen);
+void handle_collision();
 
 #endif
 
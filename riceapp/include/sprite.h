@@ -0,0 +1,44 @@
+#ifndef SPRITE_H
+#define SPRITE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "cube.h"
+
+// Sprite cache: the cube's look only depends on its rotation angle, so N
+// evenly spaced angles are rendered once into tightly bounded run-length
+// encoded sprites and each frame is a single RLE blit of the nearest one.
+
+#define SPRITE_KEY 0x000000                     // Transparent colour while rasterizing
+#define SPRITE_DEFAULT_STEPS 180
+#define SPRITE_DEFAULT_LIMIT (4u * 1024 * 1024) // Bytes
+
+// Encoded rows, one after another: the run count, then for each run the
+// transparent pixels to skip, the run length and the run's pixels.
+typedef struct {
+    int width, height;
+    int origin_x, origin_y;     // Cube centre inside the bounding box
+    uint32_t *data;             // NULL while not cached
+    size_t bytes;
+    unsigned long last_used;
+} Sprite;
+
+typedef struct {
+    Vertex model[8];
+    int steps;                  // Rotation steps per full turn
+    size_t limit;               // Memory budget for encoded sprites
+    size_t used;
+    unsigned long clock;        // Bumped on every lookup, for LRU
+    int pinned;                 // Step on screen now; kept so it can be erased
+    unsigned long hits, misses, evictions;
+    Sprite *sprites;
+} SpriteCache;
+
+int sprite_cache_init(SpriteCache *cache, const Vertex model[8], int steps, size_t limit);
+void sprite_cache_free(SpriteCache *cache);
+int sprite_cache_step(const SpriteCache *cache, float angle);
+Sprite *sprite_cache_get(SpriteCache *cache, int step);
+void sprite_blit(const Sprite *sprite, int x, int y);
+void sprite_erase(const Sprite *sprite, int x, int y);
+
+#endif
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -7,6 +8,15 @@
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include "cube.h"
+#include "sprite.h"
+#include "evloop.h"
+#include "vt.h"
+#include "profile.h"
+
+#define FRAME_INTERVAL_NS 16666667L  // 60 FPS
+#define IDLE_INTERVAL_NS 266666672L  // Back off to 16 frame periods when nothing moves on screen
+#define UNATTENDED_AFTER_NS 30000000000L  // No key for this long: nobody is watching closely
+#define UNATTENDED_INTERVAL_NS 66666668L  // 15 FPS until the next key
 
 // Framebuffer and screen parameters
 int fbfd = 0;
@@ -14,6 +24,8 @@ struct fb_var_screeninfo vinfo;
 struct fb_fix_screeninfo finfo;
 long int screensize = 0;
 char *fbp = 0;
+struct palette palette;
+const unsigned int cube_colors[CUBE_COLORS] = { 0x000000, 0xFFFFFF, 0x00FF00, 0xFF0000 };
 
 // Cube vertex data
 Vertex vertices[8] = {
@@ -24,11 +36,12 @@ Vertex vertices[8] = {
 float velocityX = 2.0, velocityY = 1.5;
 float rotationSpeed = 0.02;
 float cubeX = 300, cubeY = 200;
-Screen screen = {800, 600}; // Screen resolution
+Screen screen = {800, 600}; // Screen resolution, replaced by the panel's in init_framebuffer()
 
 // Initialize framebuffer
 void init_framebuffer() {
-    fbfd = open("/dev/fb0", O_RDWR);
+    const char *device = getenv("FRAMEBUFFER");  // e.g. /dev/fb1, as for other framebuffer programs
+    fbfd = open(device != NULL ? device : "/dev/fb0", O_RDWR);
     if (fbfd == -1) {
         perror("Error opening framebuffer device");
         exit(1);
@@ -41,29 +54,70 @@ void init_framebuffer() {
         perror("Error reading variable information");
         exit(3);
     }
+    palette_open(&palette, fbfd, vinfo, finfo);
+    if (vinfo.bits_per_pixel != 32 && vinfo.bits_per_pixel != 16 && !palette.pseudocolor) {
+        fprintf(stderr, "Error: need a 16 or 32 bpp framebuffer, or 8 bpp pseudocolor (this one is %u bpp)\n",
+                vinfo.bits_per_pixel);
+        exit(3);
+    }
+    screen.width = vinfo.xres;
+    screen.height = vinfo.yres;
     screensize = vinfo.yres_virtual * finfo.line_length;
     fbp = (char *)mmap(0, screensize, PROT_READ | PROT_WRITE, MAP_SHARED, fbfd, 0);
-    if ((int)fbp == -1) {
+    if (fbp == MAP_FAILED) {
         perror("Error mapping framebuffer device to memory");
         exit(4);
     }
+
+    // An 8-bit device draws colormap indices, so load the edge colours
+    if (palette.pseudocolor) {
+        for (int i = 0; i < CUBE_COLORS; i++) palette_set(&palette, i, cube_colors[i]);
+        palette_touch_all(&palette);
+        palette_commit(&palette, fbfd);
+    }
+}
+
+// The colormap entry for an edge colour; anything else is drawn black
+static uint8_t color_index(unsigned int color) {
+    for (int i = 1; i < CUBE_COLORS; i++) {
+        if (cube_colors[i] == color) return i;
+    }
+    return CUBE_BLACK;
+}
+
+// One xRGB colour in the device's format
+static void write_pixel(char *p, unsigned int color) {
+    switch (vinfo.bits_per_pixel) {
+        case 32: *((uint32_t *)p) = color; break;
+        case 16: *((uint16_t *)p) = ((color & 0xF80000) >> 8) | ((color & 0x00FC00) >> 5) | ((color & 0x0000F8) >> 3); break;
+        default: *p = color_index(color); break;
+    }
 }
 
-// Clear screen
+void store_pixels(char *dst, const uint32_t *src, int count) {
+    if (vinfo.bits_per_pixel == 32) {
+        memcpy(dst, src, count * sizeof(uint32_t));
+        return;
+    }
+    int bytes = vinfo.bits_per_pixel / 8;
+    for (int i = 0; i < count; i++) write_pixel(dst + i * bytes, src[i]);
+}
+
+// Clear screen: black is zero in every format, and colormap entry 0
 void clear_screen() {
     for (int y = 0; y < screen.height; y++) {
-        for (int x = 0; x < screen.width; x++) {
-            long int location = (x + vinfo.xoffset) * (vinfo.bits_per_pixel / 8) + (y + vinfo.yoffset) * finfo.line_length;
-            *((unsigned int*)(fbp + location)) = 0x000000; // Black color
-        }
+        long int location = vinfo.xoffset * (vinfo.bits_per_pixel / 8) + (y + vinfo.yoffset) * finfo.line_length;
+        memset(fbp + location, 0, (size_t)screen.width * (vinfo.bits_per_pixel / 8));
     }
+    PROF_COUNT(PROF_PIXELS, screen.width * screen.height);
 }
 
 // Put pixel on screen
 void put_pixel(int x, int y, unsigned int color) {
     if (x >= 0 && x < screen.width && y >= 0 && y < screen.height) {
         long int location = (x + vinfo.xoffset) * (vinfo.bits_per_pixel / 8) + (y + vinfo.yoffset) * finfo.line_length;
-        *((unsigned int*)(fbp + location)) = color;
+        write_pixel(fbp + location, color);
+        PROF_COUNT(PROF_PIXELS, 1);
     }
 }
 
@@ -73,6 +127,7 @@ void draw_line(int x1, int y1, int x2, int y2, unsigned int color) {
     int dy = -abs(y2 - y1), sy = y1 < y2 ? 1 : -1;
     int err = dx + dy, e2;
     
+    PROF_COUNT(PROF_LINES, 1);
     while (1) {
         put_pixel(x1, y1, color);
         if (x1 == x2 && y1 == y2) break;
@@ -82,34 +137,44 @@ void draw_line(int x1, int y1, int x2, int y2, unsigned int color) {
     }
 }
 
-// Project 3D coordinates to 2D
-void project(Vertex v, int *x, int *y) {
+// Project 3D coordinates to 2D around a centre point
+void project_point(Vertex v, float centerX, float centerY, int *x, int *y) {
     float scale = 200 / (v.z + 200);  // Perspective projection scaling
-    *x = (int)(v.x * scale + cubeX);
-    *y = (int)(v.y * scale + cubeY);
+    // floor, not truncation, so a sprite rendered around (0, 0) lines up exactly when moved
+    *x = (int)floorf(v.x * scale + centerX);
+    *y = (int)floorf(v.y * scale + centerY);
 }
 
-// Draw the 3D cube
-void draw_cube(Vertex vertices[8]) {
-    int projectedX[8], projectedY[8];
-    for (int i = 0; i < 8; i++) {
-        project(vertices[i], &projectedX[i], &projectedY[i]);
-    }
-    
+// Project 3D coordinates to 2D at the cube's current position
+void project(Vertex v, int *x, int *y) {
+    project_point(v, cubeX, cubeY, x, y);
+}
+
+// Draw the cube's edges from projected vertices with the given line routine
+void draw_cube_edges(const int projectedX[8], const int projectedY[8], line_fn line) {
     // Draw front face
     for (int i = 0; i < 4; i++) {
-        draw_line(projectedX[i], projectedY[i], projectedX[(i+1)%4], projectedY[(i+1)%4], 0xFFFFFF);
+        line(projectedX[i], projectedY[i], projectedX[(i+1)%4], projectedY[(i+1)%4], cube_colors[CUBE_WHITE]);
     }
     
     // Draw back face
     for (int i = 4; i < 8; i++) {
-        draw_line(projectedX[i], projectedY[i], projectedX[((i+1)%4)+4], projectedY[((i+1)%4)+4], 0x00FF00);
+        line(projectedX[i], projectedY[i], projectedX[((i+1)%4)+4], projectedY[((i+1)%4)+4], cube_colors[CUBE_GREEN]);
     }
     
     // Draw edges between front and back faces
     for (int i = 0; i < 4; i++) {
-        draw_line(projectedX[i], projectedY[i], projectedX[i+4], projectedY[i+4], 0xFF0000);
+        line(projectedX[i], projectedY[i], projectedX[i+4], projectedY[i+4], cube_colors[CUBE_RED]);
+    }
+}
+
+// Draw the 3D cube
+void draw_cube(Vertex vertices[8]) {
+    int projectedX[8], projectedY[8];
+    for (int i = 0; i < 8; i++) {
+        project(vertices[i], &projectedX[i], &projectedY[i]);
     }
+    draw_cube_edges(projectedX, projectedY, draw_line);
 }
 
 // Translate vertices
@@ -129,7 +194,7 @@ void rotate_cube(Vertex vertices[8], float angleX, float angleY) {
         
         // Rotation around X-axis
         vertices[i].y = y * cosX - z * sinX;
-        vertices[i].z = y * sinX + z * cosX;
+        z = y * sinX + z * cosX;
         
         // Rotation around Y-axis
         vertices[i].x = x * cosY - z * sinY;
@@ -143,36 +208,220 @@ void handle_collision() {
     if (cubeY >= screen.height - 100 || cubeY <= 100) velocityY = -velocityY;
 }
 
-int main() {
-    init_framebuffer();
-    
-    float angleX = 0.0, angleY = 0.0;
-    
-    while (1) {
+// Per-run state shared by the event handlers
+typedef struct {
+    int sprite_steps;
+    SpriteCache cache;
+    Sprite *shown;
+    int shownX, shownY;
+    float angle;    // The pose is a function of this one angle, which is what makes it cacheable
+    float speed;    // Multiplier for translation and rotation, Up/Down change it
+    int paused;
+    int repaint;    // Clear everything on the next frame, e.g. after the console drew over us
+    int frame_timer;
+    int unattended_timer;
+    struct evloop_pacer pacer;
+} AppState;
+
+// Draw the cube at the current position and angle
+void render_frame(void *ctx) {
+    AppState *app = ctx;
+
+    PROF_FRAME_BEGIN();
+    if (app->sprite_steps > 0) {
+        PROF_BEGIN(PROF_CLEAR);
+        if (app->repaint) {
+            clear_screen();
+            app->shown = NULL;
+            app->repaint = 0;
+        }
+
+        // Replace last frame's sprite with the nearest cached rotation step
+        int step = sprite_cache_step(&app->cache, app->angle);
+        Sprite *sprite = sprite_cache_get(&app->cache, step);
+        if (app->shown != NULL) sprite_erase(app->shown, app->shownX, app->shownY);
+        PROF_END(PROF_CLEAR);
+
+        PROF_BEGIN(PROF_RASTERIZE);
+        if (sprite != NULL) {
+            app->shownX = (int)cubeX;
+            app->shownY = (int)cubeY;
+            sprite_blit(sprite, app->shownX, app->shownY);
+            app->cache.pinned = step;
+        }
+        app->shown = sprite;
+        PROF_END(PROF_RASTERIZE);
+    } else {
         // Clear the screen
+        PROF_BEGIN(PROF_CLEAR);
         clear_screen();
-        
+        PROF_END(PROF_CLEAR);
+
+        // Rotate a copy of the cube and draw it on the screen
+        PROF_BEGIN(PROF_TRANSFORM);
+        Vertex pose[8];
+        memcpy(pose, vertices, sizeof(pose));
+        rotate_cube(pose, app->angle, app->angle);
+        PROF_END(PROF_TRANSFORM);
+        PROF_BEGIN(PROF_RASTERIZE);
+        draw_cube(pose);
+        PROF_END(PROF_RASTERIZE);
+    }
+    PROF_FRAME_END();
+}
+
+// What the next frame would put on screen: the sprite step and its position,
+// or the projected corners when drawing directly
+static int frame_key(const AppState *app, int key[16]) {
+    if (app->sprite_steps > 0) {
+        key[0] = sprite_cache_step(&app->cache, app->angle);
+        key[1] = (int)cubeX;
+        key[2] = (int)cubeY;
+        return 3;
+    }
+    Vertex pose[8];
+    memcpy(pose, vertices, sizeof(pose));
+    rotate_cube(pose, app->angle, app->angle);
+    for (int i = 0; i < 8; i++) {
+        project(pose[i], &key[2 * i], &key[2 * i + 1]);
+    }
+    return 16;
+}
+
+// Advance the simulation one step per elapsed frame period. At low speeds
+// the picture can stay the same for several periods; the pacer then
+// stretches the timer and each tick covers that many periods instead.
+void on_frame_tick(struct evloop *loop, uint64_t expirations, void *ctx) {
+    AppState *app = ctx;
+    uint64_t steps = expirations * (app->pacer.current_ns / FRAME_INTERVAL_NS);
+    for (uint64_t i = 0; i < steps; i++) {
         // Translate the cube across the screen
-        cubeX += velocityX;
-        cubeY += velocityY;
+        cubeX += velocityX * app->speed;
+        cubeY += velocityY * app->speed;
         handle_collision();
-        
-        // Rotate the cube
-        rotate_cube(vertices, angleX, angleY);
-        
-        // Draw the cube on the screen
-        draw_cube(vertices);
-        
-        // Update rotation angles for the next iteration
-        angleX += rotationSpeed;
-        angleY += rotationSpeed;
 
-        // Add delay to control frame rate (~60 FPS)
-        usleep(16000);
+        // Update the rotation angle for the next frame
+        app->angle += rotationSpeed * app->speed;
+        if (app->angle >= 2 * M_PI) app->angle -= 2 * M_PI;
+    }
+
+    int key[16];
+    int n = frame_key(app, key);
+    if (evloop_pacer_update(loop, &app->pacer, key, n * sizeof(int))) loop->dirty = 1;
+}
+
+// Restart the frame timer at the base rate
+static void resume_frames(struct evloop *loop, AppState *app) {
+    evloop_pacer_reset(loop, &app->pacer);
+    evloop_set_timer(loop, app->frame_timer, app->pacer.base_ns);
+}
+
+// Nobody has touched a key for UNATTENDED_AFTER_NS: keep animating, but at
+// a quarter of the rate, each tick covering four periods. It is a one-shot;
+// the next key re-arms it.
+void on_unattended(struct evloop *loop, uint64_t expirations, void *ctx) {
+    AppState *app = ctx;
+    evloop_set_timer(loop, app->unattended_timer, 0);
+    evloop_pacer_set_base(&app->pacer, UNATTENDED_INTERVAL_NS);
+    if (!app->paused && !loop->suspended) resume_frames(loop, app);
+}
+
+// Up/Down change speed, Space/p pauses (no wakeups at all while paused), q/Esc quits
+void on_key(struct evloop *loop, int key, void *ctx) {
+    AppState *app = ctx;
+    evloop_set_timer(loop, app->unattended_timer, UNATTENDED_AFTER_NS);
+    if (app->pacer.base_ns != FRAME_INTERVAL_NS) {
+        evloop_pacer_set_base(&app->pacer, FRAME_INTERVAL_NS);
+        if (!app->paused) resume_frames(loop, app);
+    }
+    switch (key) {
+        case KEY_UP:
+            if (app->speed < 8.0) app->speed *= 1.25;
+            if (!app->paused) resume_frames(loop, app);
+            break;
+        case KEY_DOWN:
+            if (app->speed > 0.125) app->speed /= 1.25;
+            if (!app->paused) resume_frames(loop, app);
+            break;
+        case KEY_SPACE:
+        case KEY_P:
+            app->paused = !app->paused;
+            if (app->paused) {
+                evloop_set_timer(loop, app->frame_timer, 0);
+            } else {
+                resume_frames(loop, app);
+            }
+            break;
+        case KEY_Q:
+        case KEY_ESC:
+            loop->running = 0;
+            break;
+    }
+}
+
+// Stop the frame timer while another VT is in front; repaint from scratch on
+// return. The other VT may have loaded its own colormap, so ours goes back.
+void on_vt_change(struct evloop *loop, int visible, void *ctx) {
+    AppState *app = ctx;
+    if (!visible) {
+        evloop_set_timer(loop, app->frame_timer, 0);
+        return;
+    }
+    palette_touch_all(&palette);
+    palette_commit(&palette, fbfd);
+    app->repaint = 1;
+    if (!app->paused) resume_frames(loop, app);
+}
+
+// Give up after init_framebuffer(): the device's colormap goes back first
+static void fail(int status) {
+    palette_restore(&palette, fbfd);
+    exit(status);
+}
+
+// Usage: cube_app [-s steps] [-m cache_kb]
+// -s enables the sprite cache with the given number of rotation steps
+int main(int argc, char *argv[]) {
+    AppState app = { .speed = 1.0, .repaint = 1 };  // Start from a clean screen: the console text is still there
+    size_t sprite_limit = SPRITE_DEFAULT_LIMIT;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:m:")) != -1) {
+        switch (opt) {
+            case 's': app.sprite_steps = atoi(optarg); break;
+            case 'm': sprite_limit = (size_t)atol(optarg) * 1024; break;
+            default:
+                fprintf(stderr, "Usage: %s [-s steps] [-m cache_kb]\n", argv[0]);
+                exit(1);
+        }
+    }
+
+    init_framebuffer();
+
+    if (app.sprite_steps > 0 && sprite_cache_init(&app.cache, vertices, app.sprite_steps, sprite_limit) != 0) {
+        perror("Error building sprite cache");
+        fail(5);
     }
+
+    // ~60 FPS frame timer; returns on q or SIGINT/SIGTERM so the cleanup below runs
+    struct evloop loop;
+    if (evloop_init(&loop) != 0) fail(6);
+    app.frame_timer = evloop_add_timer(&loop, FRAME_INTERVAL_NS, 0, on_frame_tick, &app);
+    if (app.frame_timer < 0) fail(6);
+    evloop_pacer_init(&app.pacer, app.frame_timer, FRAME_INTERVAL_NS, IDLE_INTERVAL_NS);
+    app.unattended_timer = evloop_add_timer(&loop, UNATTENDED_AFTER_NS, 0, on_unattended, &app);
+    if (app.unattended_timer < 0) fail(6);
+    evloop_add_input(&loop, on_key, &app);
+    struct vt_state vt;
+    vt_init(&vt, &loop, on_vt_change, &app);
+    PROF_INIT("riceapp");
+    evloop_run(&loop, render_frame, &app);
+    PROF_SHUTDOWN();
+    vt_restore(&vt);
+    evloop_close(&loop);
     
+    if (app.sprite_steps > 0) sprite_cache_free(&app.cache);
+    palette_restore(&palette, fbfd);
     munmap(fbp, screensize);
     close(fbfd);
     return 0;
 }
-
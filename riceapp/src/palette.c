@@ -0,0 +1,88 @@
+#include "../include/palette.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+
+void palette_open(struct palette *pal, int fd, struct fb_var_screeninfo vinfo, struct fb_fix_screeninfo finfo) {
+    memset(pal, 0, sizeof(*pal));
+    pal->dirty_lo = 256;
+    pal->dirty_hi = -1;
+    pal->pseudocolor = vinfo.bits_per_pixel == 8 && finfo.visual == FB_VISUAL_PSEUDOCOLOR;
+    if (!pal->pseudocolor) return;
+
+    struct fb_cmap cmap = { 0, 256, pal->saved_red, pal->saved_green, pal->saved_blue, NULL };
+    if (ioctl(fd, FBIOGETCMAP, &cmap) == 0) {
+        pal->saved = 1;
+    } else {
+        perror("Error reading colormap");
+    }
+}
+
+void palette_restore(struct palette *pal, int fd) {
+    if (!pal->saved) return;
+    struct fb_cmap cmap = { 0, 256, pal->saved_red, pal->saved_green, pal->saved_blue, NULL };
+    if (ioctl(fd, FBIOPUTCMAP, &cmap) != 0) perror("Error restoring colormap");
+}
+
+void palette_set(struct palette *pal, int index, uint32_t rgb) {
+    rgb &= 0xFFFFFF;
+    if (pal->lut[index] == rgb) return;  // Nothing to load
+
+    pal->lut[index] = rgb;
+    // 8-bit channels widened to 16 bits by repeating them (0xAB -> 0xABAB)
+    pal->red[index] = ((rgb >> 16) & 0xFF) * 0x101;
+    pal->green[index] = ((rgb >> 8) & 0xFF) * 0x101;
+    pal->blue[index] = (rgb & 0xFF) * 0x101;
+    if (index < pal->dirty_lo) pal->dirty_lo = index;
+    if (index > pal->dirty_hi) pal->dirty_hi = index;
+}
+
+void palette_ramp(struct palette *pal, int first, int count, uint32_t from, uint32_t to) {
+    for (int i = 0; i < count; i++) {
+        int t = count > 1 ? i * 256 / (count - 1) : 0;
+        if (t > 256) t = 256;
+        uint32_t rgb = 0;
+        for (int shift = 0; shift <= 16; shift += 8) {
+            int a = (from >> shift) & 0xFF, b = (to >> shift) & 0xFF;
+            rgb |= (uint32_t)((a * (256 - t) + b * t) >> 8) << shift;
+        }
+        palette_set(pal, first + i, rgb);
+    }
+}
+
+void palette_touch_all(struct palette *pal) {
+    pal->dirty_lo = 0;
+    pal->dirty_hi = 255;
+}
+
+int palette_commit(struct palette *pal, int fd) {
+    if (pal->dirty_lo > pal->dirty_hi) return 0;
+    int count = pal->dirty_hi - pal->dirty_lo + 1;
+    if (pal->pseudocolor) {
+        int lo = pal->dirty_lo;
+        struct fb_cmap cmap = { lo, count, &pal->red[lo], &pal->green[lo], &pal->blue[lo], NULL };
+        if (ioctl(fd, FBIOPUTCMAP, &cmap) != 0) perror("Error loading colormap");
+    }
+    pal->dirty_lo = 256;
+    pal->dirty_hi = -1;
+    return count;
+}
+
+void palette_expand(uint32_t *dst, const uint8_t *src, int count, const uint32_t *lut) {
+    int i = 0;
+    // Eight independent lookups per iteration keep the loads in flight
+    for (; i + 8 <= count; i += 8) {
+        uint32_t a = lut[src[i]], b = lut[src[i + 1]], c = lut[src[i + 2]], d = lut[src[i + 3]];
+        uint32_t e = lut[src[i + 4]], f = lut[src[i + 5]], g = lut[src[i + 6]], h = lut[src[i + 7]];
+        dst[i] = a; dst[i + 1] = b; dst[i + 2] = c; dst[i + 3] = d;
+        dst[i + 4] = e; dst[i + 5] = f; dst[i + 6] = g; dst[i + 7] = h;
+    }
+    for (; i < count; i++) dst[i] = lut[src[i]];
+}
+
+void palette_expand_pixels(uint32_t *dst, const uint8_t *src, const int *offsets, int count, const uint32_t *lut) {
+    for (int i = 0; i < count; i++) {
+        int o = offsets[i];
+        dst[o] = lut[src[o]];
+    }
+}
@@ -0,0 +1,223 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "sprite.h"
+#include "profile.h"
+
+// Scratch raster the cube is drawn into before encoding
+static uint32_t *scratch = NULL;
+static int scratch_width = 0, scratch_height = 0;
+static int scratch_left = 0, scratch_top = 0;
+
+static void scratch_pixel(int x, int y, unsigned int color) {
+    x -= scratch_left;
+    y -= scratch_top;
+    if (x >= 0 && x < scratch_width && y >= 0 && y < scratch_height) {
+        scratch[y * scratch_width + x] = color;
+    }
+}
+
+// Bresenham into the scratch raster, same as draw_line in cube.c
+static void scratch_line(int x1, int y1, int x2, int y2, unsigned int color) {
+    int dx = abs(x2 - x1), sx = x1 < x2 ? 1 : -1;
+    int dy = -abs(y2 - y1), sy = y1 < y2 ? 1 : -1;
+    int err = dx + dy, e2;
+
+    while (1) {
+        scratch_pixel(x1, y1, color);
+        if (x1 == x2 && y1 == y2) break;
+        e2 = 2 * err;
+        if (e2 >= dy) { err += dy; x1 += sx; }
+        if (e2 <= dx) { err += dx; y1 += sy; }
+    }
+}
+
+// Run-length encode the scratch raster, dropping SPRITE_KEY pixels
+static int encode_scratch(Sprite *sprite) {
+    size_t words = 0;
+    for (int y = 0; y < scratch_height; y++) {
+        const uint32_t *row = scratch + y * scratch_width;
+        words++;
+        for (int x = 0; x < scratch_width; x++) {
+            if (row[x] == SPRITE_KEY) continue;
+            if (x == 0 || row[x - 1] == SPRITE_KEY) words += 2;
+            words++;
+        }
+    }
+
+    uint32_t *data = malloc(words * sizeof(uint32_t));
+    if (data == NULL) return -1;
+
+    uint32_t *p = data;
+    for (int y = 0; y < scratch_height; y++) {
+        const uint32_t *row = scratch + y * scratch_width;
+        uint32_t *runs = p++;
+        *runs = 0;
+        int x = 0, last_end = 0;
+        while (x < scratch_width) {
+            if (row[x] == SPRITE_KEY) { x++; continue; }
+            int start = x;
+            while (x < scratch_width && row[x] != SPRITE_KEY) x++;
+            *p++ = start - last_end;
+            *p++ = x - start;
+            memcpy(p, row + start, (x - start) * sizeof(uint32_t));
+            p += x - start;
+            last_end = x;
+            (*runs)++;
+        }
+    }
+
+    sprite->data = data;
+    sprite->bytes = words * sizeof(uint32_t);
+    return 0;
+}
+
+// Rasterize the cube at rotation step `step` into an encoded sprite
+static int render_sprite(SpriteCache *cache, int step, Sprite *sprite) {
+    float angle = step * 2 * M_PI / cache->steps;
+    Vertex pose[8];
+    int projectedX[8], projectedY[8];
+
+    memcpy(pose, cache->model, sizeof(pose));
+    rotate_cube(pose, angle, angle);
+
+    int minX = 0, minY = 0, maxX = 0, maxY = 0;
+    for (int i = 0; i < 8; i++) {
+        project_point(pose[i], 0, 0, &projectedX[i], &projectedY[i]);
+        if (i == 0 || projectedX[i] < minX) minX = projectedX[i];
+        if (i == 0 || projectedX[i] > maxX) maxX = projectedX[i];
+        if (i == 0 || projectedY[i] < minY) minY = projectedY[i];
+        if (i == 0 || projectedY[i] > maxY) maxY = projectedY[i];
+    }
+
+    scratch_left = minX;
+    scratch_top = minY;
+    scratch_width = maxX - minX + 1;
+    scratch_height = maxY - minY + 1;
+    scratch = calloc((size_t)scratch_width * scratch_height, sizeof(uint32_t));
+    if (scratch == NULL) return -1;
+
+    draw_cube_edges(projectedX, projectedY, scratch_line);
+
+    sprite->width = scratch_width;
+    sprite->height = scratch_height;
+    sprite->origin_x = -minX;
+    sprite->origin_y = -minY;
+    int result = encode_scratch(sprite);
+
+    free(scratch);
+    scratch = NULL;
+    return result;
+}
+
+static void evict_lru(SpriteCache *cache, int keep) {
+    int victim = -1;
+    for (int i = 0; i < cache->steps; i++) {
+        if (i == keep || i == cache->pinned || cache->sprites[i].data == NULL) continue;
+        if (victim < 0 || cache->sprites[i].last_used < cache->sprites[victim].last_used) victim = i;
+    }
+    if (victim < 0) return;
+
+    free(cache->sprites[victim].data);
+    cache->sprites[victim].data = NULL;
+    cache->used -= cache->sprites[victim].bytes;
+    cache->evictions++;
+}
+
+// Pre-render as many steps as fit in the memory budget
+int sprite_cache_init(SpriteCache *cache, const Vertex model[8], int steps, size_t limit) {
+    memset(cache, 0, sizeof(*cache));
+    memcpy(cache->model, model, sizeof(cache->model));
+    cache->steps = steps;
+    cache->limit = limit;
+    cache->pinned = -1;
+    cache->sprites = calloc(steps, sizeof(Sprite));
+    if (cache->sprites == NULL) return -1;
+
+    for (int step = 0; step < steps; step++) {
+        Sprite *sprite = &cache->sprites[step];
+        if (render_sprite(cache, step, sprite) != 0) return -1;
+        if (cache->used + sprite->bytes > limit) {
+            free(sprite->data);
+            sprite->data = NULL;
+            break;
+        }
+        cache->used += sprite->bytes;
+    }
+    return 0;
+}
+
+void sprite_cache_free(SpriteCache *cache) {
+    for (int i = 0; i < cache->steps; i++) {
+        free(cache->sprites[i].data);
+    }
+    free(cache->sprites);
+    cache->sprites = NULL;
+    cache->used = 0;
+}
+
+// Nearest cached step for a rotation angle
+int sprite_cache_step(const SpriteCache *cache, float angle) {
+    int step = (int)lroundf(angle / (2 * M_PI) * cache->steps) % cache->steps;
+    return step < 0 ? step + cache->steps : step;
+}
+
+// Look up a step, rendering it (and evicting least recently used sprites) on a miss
+Sprite *sprite_cache_get(SpriteCache *cache, int step) {
+    Sprite *sprite = &cache->sprites[step];
+    sprite->last_used = ++cache->clock;
+    if (sprite->data != NULL) {
+        cache->hits++;
+        return sprite;
+    }
+
+    cache->misses++;
+    if (render_sprite(cache, step, sprite) != 0) return NULL;
+    while (cache->used + sprite->bytes > cache->limit) {
+        size_t before = cache->used;
+        evict_lru(cache, step);
+        if (cache->used == before) break;  // Only the pinned sprite is left; go over budget
+    }
+    cache->used += sprite->bytes;
+    return sprite;
+}
+
+// Walk the runs of a sprite placed with its centre at (x, y), copying the
+// pixels or clearing them to black
+static void sprite_runs(const Sprite *sprite, int x, int y, int erase) {
+    const uint32_t *p = sprite->data;
+    int left = x - sprite->origin_x;
+    int top = y - sprite->origin_y;
+
+    for (int row = 0; row < sprite->height; row++) {
+        uint32_t runs = *p++;
+        int sy = top + row;
+        int cx = left;
+        for (uint32_t r = 0; r < runs; r++) {
+            cx += *p++;
+            int len = *p++;
+            int start = cx < 0 ? 0 : cx;
+            int end = cx + len > screen.width ? screen.width : cx + len;
+            if (sy >= 0 && sy < screen.height && start < end) {
+                long int location = (start + vinfo.xoffset) * (vinfo.bits_per_pixel / 8) + (sy + vinfo.yoffset) * finfo.line_length;
+                if (erase) {
+                    memset(fbp + location, 0, (end - start) * (vinfo.bits_per_pixel / 8));
+                } else {
+                    store_pixels(fbp + location, p + (start - cx), end - start);
+                }
+                PROF_COUNT(PROF_PIXELS, end - start);
+            }
+            p += len;
+            cx += len;
+        }
+    }
+}
+
+void sprite_blit(const Sprite *sprite, int x, int y) {
+    sprite_runs(sprite, x, y, 0);
+}
+
+void sprite_erase(const Sprite *sprite, int x, int y) {
+    sprite_runs(sprite, x, y, 1);
+}
@@ -0,0 +1,39 @@
+// include/arc.h
+#ifndef ARC_H
+#define ARC_H
+
+#include <stdint.h>
+#include <linux/fb.h>
+
+// The pixels of a ring, found once at startup and sorted by angle
+// (clockwise from 12 o'clock) into ARC_STEPS buckets. Drawing any arc of
+// the ring is then a walk over a slice of pixel offsets, with no trig per
+// frame. Moving the arc's end only touches the buckets between its old
+// and new positions. Pixels are 8-bit palette indices (include/palette.h),
+// so the lit part can be a ramp of entries, one per band of buckets.
+
+#define ARC_STEPS 2048
+
+struct arc {
+    int *offsets;               // Framebuffer pixel indices, bucket by bucket
+    int start[ARC_STEPS + 1];   // Bucket s is offsets[start[s]] .. offsets[start[s + 1] - 1]
+    int lit;                    // Buckets [0, lit) are currently in the arc colour
+    int changed_from;           // offsets[changed_from .. changed_to - 1] were written by the last update
+    int changed_to;
+};
+
+// Ring centred on (center_x, center_y) from inner to outer radius,
+// clipped to the screen; returns -1 if out of memory
+int arc_init(struct arc *arc, struct fb_var_screeninfo vinfo, int center_x, int center_y, int inner, int outer);
+void arc_free(struct arc *arc);
+
+// Paint buckets [from, to)
+void arc_fill(const struct arc *arc, uint8_t *framebuffer, int from, int to, int color);
+// Paint the whole ring: [0, lit) in the `bands` entries from color on
+// (first band at 12 o'clock), the rest in track_color
+void arc_draw(struct arc *arc, uint8_t *framebuffer, int lit, int color, int bands, int track_color);
+// Move the end of the arc to lit, repainting only the buckets in between;
+// returns the number of pixels written
+int arc_update(struct arc *arc, uint8_t *framebuffer, int lit, int color, int bands, int track_color);
+
+#endif
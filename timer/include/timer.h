@@ -15,17 +15,40 @@
 #include <errno.h>
 #include <stdint.h>
 #include <sys/statvfs.h>    // For disk usage calculations
+#include "fixed.h"
 
+// Design size of the layout; the face is placed on whatever the panel is
 #define SCREEN_WIDTH 800
 #define SCREEN_HEIGHT 600
-#define CENTER_X (SCREEN_WIDTH / 2)
-#define CENTER_Y (SCREEN_HEIGHT / 2)
+// Layout follows the panel's geometry (the `vinfo` in scope)
+#define CENTER_X layout_center_x(vinfo)
+#define CENTER_Y layout_center_y(vinfo)
 #define RADIUS 200
+#define FACE_MARGIN 20      // Room around the ring
+#define STATS_TOP 300       // Stats below the face: their top, from the centre
+#define STATS_ROW 50        // Rows of stats are this far apart
+#define STATS_WIDTH 200
+#define STATS_HEIGHT 160    // Four rows of size-2 text
+#define STATS_LABELS 160    // Label column; the bars start this far in
+#define TEXT_BELOW 270      // Date and time reach this far below the centre
 #define HOUR_HAND_LENGTH 100
 #define MINUTE_HAND_LENGTH 150
 
-#define RING_COLOR 0xFFFFFF  // White color
-#define TIMER_COLOR 0xFFA500 // Orange color
+// Everything is drawn in palette indices (include/palette.h); the colours
+// behind them are set up by init_timer_palette()
+enum {
+    PAL_BLACK,
+    PAL_WHITE,
+    PAL_RING,               // Static ring; pulses while the countdown runs
+    PAL_TIMER,              // Countdown digits
+    PAL_TRACK,              // Spent part of the arc
+    PAL_BAR_TRACK,          // Empty part of the stats bars
+    PAL_ARC = 16,           // PAL_ARC_BANDS entries along the arc, cycled while it runs
+};
+#define PAL_ARC_BANDS 32
+
+#define RING_COLOR PAL_RING
+#define TIMER_COLOR PAL_TIMER
 #define TIMER_START_VALUE 60 // Start value of the countdown timer in seconds
 
 typedef struct {
@@ -35,14 +58,74 @@ typedef struct {
 
 typedef struct fb_var_screeninfo fb_var_screeninfo; // Alias for convenience
 
-typedef int framebuffer_t;  // Define the framebuffer_t as an int for this context
+// The stats go under the face when the panel is tall enough for both
+// (680 px); on shorter ones, such as 800x600, they go beside the dial
+static inline int layout_stats_beside(fb_var_screeninfo vinfo) {
+    return (int)vinfo.yres < RADIUS + FACE_MARGIN + STATS_TOP + STATS_HEIGHT;
+}
+
+// Centred, or with the stats beside it, the dial and stats centred as a
+// pair; never so far left that the ring is cut off
+static inline int layout_center_x(fb_var_screeninfo vinfo) {
+    if (!layout_stats_beside(vinfo)) return (int)vinfo.xres / 2;
+    int x = ((int)vinfo.xres - STATS_WIDTH) / 2;  // Half the space the pair leaves, then the dial's half width
+    return x < RADIUS + FACE_MARGIN ? RADIUS + FACE_MARGIN : x;
+}
+
+// Centre the face unless that pushes what is below it (the date, and the
+// stats when they are there) off the bottom; never so high that the ring
+// is cut off
+static inline int layout_center_y(fb_var_screeninfo vinfo) {
+    int below = layout_stats_beside(vinfo) ? TEXT_BELOW : STATS_TOP + STATS_HEIGHT + 10;
+    int y = (int)vinfo.yres / 2;
+    if (y > (int)vinfo.yres - below) y = (int)vinfo.yres - below;
+    if (y < RADIUS + FACE_MARGIN) y = RADIUS + FACE_MARGIN;
+    return y;
+}
+
+// Where the stats go: under the face, or beside the dial and level with
+// it, and always on screen
+struct stats_box {
+    int x, y, w, h;
+};
+
+static inline struct stats_box layout_stats(fb_var_screeninfo vinfo) {
+    struct stats_box box = { CENTER_X - 100, CENTER_Y + STATS_TOP, STATS_WIDTH, STATS_HEIGHT };
+    if (layout_stats_beside(vinfo)) {
+        box.x = CENTER_X + RADIUS + FACE_MARGIN;
+        box.y = CENTER_Y - STATS_HEIGHT / 2;
+    }
+    if (box.x + box.w > (int)vinfo.xres) box.x = (int)vinfo.xres - box.w;
+    if (box.x < 0) box.x = 0;
+    if (box.y + box.h > (int)vinfo.yres) box.y = (int)vinfo.yres - box.h;
+    if (box.y < 0) box.y = 0;
+    return box;
+}
+
+#ifdef FB_FIXED_POINT
+typedef fx_angle_t angle_t;
+#else
+typedef float angle_t;
+#endif
+
+typedef uint8_t framebuffer_t;  // One palette index per pixel
 
-void draw_ring(int *framebuffer, fb_var_screeninfo vinfo, int center_x, int center_y, int radius, int thickness, int color);
-void draw_static_ring(int *framebuffer, fb_var_screeninfo vinfo);
-void draw_dynamic_ring(int *framebuffer, fb_var_screeninfo vinfo);
-void draw_countdown_timer(int *framebuffer, fb_var_screeninfo vinfo);
-void draw_clock_face(int *framebuffer, fb_var_screeninfo vinfo);
-void update_time(int *framebuffer, fb_var_screeninfo vinfo);
-void draw_text(int *framebuffer, fb_var_screeninfo vinfo, const char *text, int x, int y, int size, int color);
+void draw_static_ring(uint8_t *framebuffer, fb_var_screeninfo vinfo);
+void draw_dynamic_ring(uint8_t *framebuffer, fb_var_screeninfo vinfo);
+void draw_countdown_timer(uint8_t *framebuffer, fb_var_screeninfo vinfo);
+int init_countdown_rings(fb_var_screeninfo vinfo);
+int update_countdown(uint8_t *framebuffer, fb_var_screeninfo vinfo);
+long long countdown_remaining_ns(void);
+void draw_clock_face(uint8_t *framebuffer, fb_var_screeninfo vinfo);
+void update_time(uint8_t *framebuffer, fb_var_screeninfo vinfo);
+void draw_text(uint8_t *framebuffer, fb_var_screeninfo vinfo, const char *text, int x, int y, int size, int color);
+void draw_line(uint8_t *framebuffer, fb_var_screeninfo vinfo, int x0, int y0, int x1, int y1, int color);
+void draw_hand(uint8_t *framebuffer, fb_var_screeninfo vinfo, angle_t angle, int length, int color);
+void update_system_info(uint8_t *framebuffer, fb_var_screeninfo vinfo);
+int get_cpu_usage();
+int get_ram_usage();
+int get_disk_usage();
+int get_battery_percentage();
+int get_cpu_temperature();
 
 #endif // TIMER_H
@@ -0,0 +1,135 @@
+#include "../include/arc.h"
+#include "../include/fixed.h"
+#include "../include/profile.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define UNSET 0xFFFF
+
+// Nearest pixel to radius r at bucket s, relative to the centre
+static void step_point(int s, int r, int *dx, int *dy) {
+#ifdef FB_FIXED_POINT
+    fx_angle_t a = (fx_angle_t)s << (32 - 11);  // 2^11 == ARC_STEPS
+    *dx = (r * fx_sin(a) + FX_ONE / 2) >> FX_SHIFT;
+    *dy = -((r * fx_cos(a) + FX_ONE / 2) >> FX_SHIFT);
+#else
+    float a = s * (float)(2 * M_PI / ARC_STEPS);
+    *dx = (int)floorf(r * sinf(a) + 0.5f);
+    *dy = -(int)floorf(r * cosf(a) + 0.5f);
+#endif
+}
+
+int arc_init(struct arc *arc, struct fb_var_screeninfo vinfo, int center_x, int center_y, int inner, int outer) {
+    memset(arc, 0, sizeof(*arc));
+    int side = 2 * outer + 1;
+    uint16_t *bucket = malloc((size_t)side * side * sizeof(uint16_t));
+    if (bucket == NULL) return -1;
+    for (int i = 0; i < side * side; i++) bucket[i] = UNSET;
+
+    // Sweep the ring; a pixel belongs to the first bucket that lands on it
+    for (int s = 0; s < ARC_STEPS; s++) {
+        for (int r = inner; r <= outer; r++) {
+            int dx, dy;
+            step_point(s, r, &dx, &dy);
+            uint16_t *b = &bucket[(dy + outer) * side + dx + outer];
+            if (*b == UNSET) *b = s;
+        }
+    }
+
+    // Ring pixels the sweep stepped over between radii take a neighbour's bucket
+    for (int y = 1; y < side - 1; y++) {
+        for (int x = 1; x < side - 1; x++) {
+            int dx = x - outer, dy = y - outer, d2 = dx * dx + dy * dy;
+            uint16_t *b = &bucket[y * side + x];
+            if (*b != UNSET || d2 < inner * inner || d2 > outer * outer) continue;
+            if (b[-1] != UNSET) *b = b[-1];
+            else if (b[1] != UNSET) *b = b[1];
+            else if (b[-side] != UNSET) *b = b[-side];
+            else if (b[side] != UNSET) *b = b[side];
+        }
+    }
+
+    // Counting sort of the on-screen pixels by bucket
+    int total = 0;
+    for (int y = 0; y < side; y++) {
+        for (int x = 0; x < side; x++) {
+            int px = center_x + x - outer, py = center_y + y - outer;
+            uint16_t *b = &bucket[y * side + x];
+            if (*b == UNSET) continue;
+            if (px < 0 || px >= (int)vinfo.xres || py < 0 || py >= (int)vinfo.yres) {
+                *b = UNSET;
+                continue;
+            }
+            arc->start[*b + 1]++;
+            total++;
+        }
+    }
+    for (int s = 0; s < ARC_STEPS; s++) arc->start[s + 1] += arc->start[s];
+    arc->offsets = malloc((total > 0 ? total : 1) * sizeof(int));
+    if (arc->offsets == NULL) {
+        free(bucket);
+        return -1;
+    }
+    int fill[ARC_STEPS];
+    memcpy(fill, arc->start, sizeof(fill));
+    for (int y = 0; y < side; y++) {
+        for (int x = 0; x < side; x++) {
+            uint16_t b = bucket[y * side + x];
+            if (b == UNSET) continue;
+            arc->offsets[fill[b]++] = (center_y + y - outer) * vinfo.xres_virtual + center_x + x - outer;
+        }
+    }
+    free(bucket);
+    return 0;
+}
+
+void arc_free(struct arc *arc) {
+    free(arc->offsets);
+    arc->offsets = NULL;
+}
+
+void arc_fill(const struct arc *arc, uint8_t *framebuffer, int from, int to, int color) {
+    for (int i = arc->start[from]; i < arc->start[to]; i++) {
+        framebuffer[arc->offsets[i]] = color;
+    }
+    if (to > from) PROF_COUNT(PROF_PIXELS, arc->start[to] - arc->start[from]);
+}
+
+// Lit buckets: band b of `bands` gets palette entry color + b
+static void fill_bands(const struct arc *arc, uint8_t *framebuffer, int from, int to, int color, int bands) {
+    if (bands <= 1) {
+        arc_fill(arc, framebuffer, from, to, color);
+        return;
+    }
+    for (int s = from; s < to;) {
+        int band = s * bands / ARC_STEPS;
+        int end = ((band + 1) * ARC_STEPS + bands - 1) / bands;  // First bucket of the next band
+        if (end > to) end = to;
+        arc_fill(arc, framebuffer, s, end, color + band);
+        s = end;
+    }
+}
+
+void arc_draw(struct arc *arc, uint8_t *framebuffer, int lit, int color, int bands, int track_color) {
+    fill_bands(arc, framebuffer, 0, lit, color, bands);
+    arc_fill(arc, framebuffer, lit, ARC_STEPS, track_color);
+    arc->lit = lit;
+    arc->changed_from = 0;
+    arc->changed_to = arc->start[ARC_STEPS];
+}
+
+int arc_update(struct arc *arc, uint8_t *framebuffer, int lit, int color, int bands, int track_color) {
+    if (lit < arc->lit) {
+        arc_fill(arc, framebuffer, lit, arc->lit, track_color);
+        arc->changed_from = arc->start[lit];
+        arc->changed_to = arc->start[arc->lit];
+    } else {
+        fill_bands(arc, framebuffer, arc->lit, lit, color, bands);
+        arc->changed_from = arc->start[arc->lit];
+        arc->changed_to = arc->start[lit];
+    }
+    arc->lit = lit;
+    return arc->changed_to - arc->changed_from;
+}
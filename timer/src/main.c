@@ -1,67 +1,365 @@
 #include "../include/timer.h"
+#include "../include/evloop.h"
+#include "../include/vt.h"
+#include "../include/arc.h"
+#include "../include/palette.h"
+#include "../include/profile.h"
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <unistd.h>
 #include <string.h>
+#include <limits.h>
 #include <time.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
 #include <sys/statvfs.h>
 
-#define RING_COLOR 0xFFFFFF    // White for the static ring
-#define TIMER_COLOR 0xFFA500   // Orange for the dynamic ring and timer
 #define TIMER_START_VALUE 60   // Start value of the countdown timer in seconds
+#define FRAME_INTERVAL_NS 16666667L  // Countdown animation rate while running
+#define NS_PER_SEC 1000000000LL
+// Countdown digits sit between the hand tips and the arc, so redrawing a
+// digit never has to repair a hand
+#define COUNTDOWN_TOP (CENTER_Y - 176)
 
-int countdown = TIMER_START_VALUE;
+// The countdown runs against a CLOCK_MONOTONIC deadline; while paused only
+// the time left is kept
+long long countdown_left_ns = TIMER_START_VALUE * NS_PER_SEC;
+long long countdown_deadline_ns = 0;
+int countdown_running = 1;
+
+// What is on screen now, so each frame only repaints what changed
+static struct arc static_ring;
+static struct arc countdown_arc;
+static char countdown_drawn[16];
+static int countdown_drawn_x;
+static int glyphs_from, glyphs_to;  // Pixel columns of the glyphs the last frame redrew
+
+// Colours behind the indices; on a pseudocolor device the ring and arc
+// entries are animated instead of their pixels
+static struct palette timer_palette;
+static uint32_t arc_ramp[PAL_ARC_BANDS];  // The arc entries at rest
 
 // Set a pixel at (x, y) with color in the framebuffer
-void set_pixel(int *framebuffer, struct fb_var_screeninfo vinfo, int x, int y, int color) {
+void set_pixel(uint8_t *framebuffer, struct fb_var_screeninfo vinfo, int x, int y, int color) {
     if (x >= 0 && x < vinfo.xres_virtual && y >= 0 && y < vinfo.yres_virtual) {
         framebuffer[y * vinfo.xres_virtual + x] = color;
+        PROF_COUNT(PROF_PIXELS, 1);
+    }
+}
+
+// Bresenham's line algorithm for drawing lines
+void draw_line(uint8_t *framebuffer, struct fb_var_screeninfo vinfo, int x0, int y0, int x1, int y1, int color) {
+    int dx = abs(x1 - x0), sx = x0 < x1 ? 1 : -1;
+    int dy = -abs(y1 - y0), sy = y0 < y1 ? 1 : -1;
+    int err = dx + dy, e2;
+
+    PROF_COUNT(PROF_LINES, 1);
+    while (1) {
+        set_pixel(framebuffer, vinfo, x0, y0, color);
+        if (x0 == x1 && y0 == y1) break;
+        e2 = 2 * err;
+        if (e2 >= dy) { err += dy; x0 += sx; }
+        if (e2 <= dx) { err += dx; y0 += sy; }
     }
 }
 
-// Draw a ring with specified thickness
-void draw_ring(int *framebuffer, struct fb_var_screeninfo vinfo, int center_x, int center_y, int radius, int thickness, int color) {
-    for (int r = radius - thickness / 2; r <= radius + thickness / 2; r++) {
-        for (int angle = 0; angle < 360; ++angle) {
-            int x = center_x + (int)(r * cos(angle * M_PI / 180));
-            int y = center_y + (int)(r * sin(angle * M_PI / 180));
-            set_pixel(framebuffer, vinfo, x, y, color);
+// Draw a simple filled rectangle to represent text characters
+void draw_char(uint8_t *framebuffer, struct fb_var_screeninfo vinfo, char c, int x, int y, int size, int color) {
+    static const char font[10][5][3] = {
+        { "111", "101", "101", "101", "111" },  // '0'
+        { "110", "010", "010", "010", "111" },  // '1'
+        { "111", "001", "111", "100", "111" },  // '2'
+        { "111", "001", "111", "001", "111" },  // '3'
+        { "101", "101", "111", "001", "001" },  // '4'
+        { "111", "100", "111", "001", "111" },  // '5'
+        { "111", "100", "111", "101", "111" },  // '6'
+        { "111", "001", "001", "001", "001" },  // '7'
+        { "111", "101", "111", "101", "111" },  // '8'
+        { "111", "101", "111", "001", "111" }   // '9'
+    };
+
+    if (c == '.') {
+        for (int i = 0; i < size; ++i) {
+            for (int j = 0; j < size; ++j) {
+                set_pixel(framebuffer, vinfo, x + size + i, y + 4 * size + j, color);
+            }
         }
+    } else if (c >= '0' && c <= '9') {
+        PROF_COUNT(PROF_GLYPHS, 1);
+        int index = c - '0';
+        for (int row = 0; row < 5; ++row) {
+            for (int col = 0; col < 3; ++col) {
+                if (font[index][row][col] == '1') {
+                    for (int i = 0; i < size; ++i) {
+                        for (int j = 0; j < size; ++j) {
+                            set_pixel(framebuffer, vinfo, x + col * size + i, y + row * size + j, color);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Draw a string of characters
+void draw_text(uint8_t *framebuffer, struct fb_var_screeninfo vinfo, const char *text, int x, int y, int size, int color) {
+    for (const char *p = text; *p; ++p) {
+        draw_char(framebuffer, vinfo, *p, x, y, size, color);
+        x += size * 4; // Move to the next character position
     }
 }
 
+// Draw clock hands
+void draw_hand(uint8_t *framebuffer, struct fb_var_screeninfo vinfo, angle_t angle, int length, int color) {
+#ifdef FB_FIXED_POINT
+    int x_end = CENTER_X + FX_TO_INT(length * fx_cos(angle));
+    int y_end = CENTER_Y + FX_TO_INT(-length * fx_sin(angle));
+#else
+    int x_end = CENTER_X + length * cos(angle);
+    int y_end = CENTER_Y - length * sin(angle);
+#endif
+    draw_line(framebuffer, vinfo, CENTER_X, CENTER_Y, x_end, y_end, color);
+}
+
+// Function to read the first line of a file
+int read_first_line(const char *path, char *buffer, size_t size) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) return -1;
+    if (fgets(buffer, size, file) == NULL) {
+        fclose(file);
+        return -1;
+    }
+    fclose(file);
+    return 0;
+}
+
+// Get system data
+int get_cpu_usage() {
+    char buffer[256];
+    unsigned long long int user, nice, system, idle;
+    read_first_line("/proc/stat", buffer, sizeof(buffer));
+    sscanf(buffer, "cpu %llu %llu %llu %llu", &user, &nice, &system, &idle);
+    
+    static unsigned long long int prev_user = 0, prev_nice = 0, prev_system = 0, prev_idle = 0;
+    unsigned long long int total_diff = (user - prev_user) + (nice - prev_nice) + (system - prev_system);
+    unsigned long long int idle_diff = idle - prev_idle;
+    int cpu_usage = (total_diff * 100) / (total_diff + idle_diff);
+
+    prev_user = user;
+    prev_nice = nice;
+    prev_system = system;
+    prev_idle = idle;
+    
+    return cpu_usage;
+}
+
+int get_ram_usage() {
+    char buffer[256];
+    unsigned long mem_total, mem_available;
+    read_first_line("/proc/meminfo", buffer, sizeof(buffer));
+    sscanf(buffer, "MemTotal: %lu kB", &mem_total);
+    read_first_line("/proc/meminfo", buffer, sizeof(buffer));
+    sscanf(buffer, "MemAvailable: %lu kB", &mem_available);
+
+    int ram_usage = ((mem_total - mem_available) * 100) / mem_total;
+    return ram_usage;
+}
+
+int get_disk_usage() {
+    struct statvfs stat;
+    if (statvfs("/", &stat) != 0) return -1;
+    
+    unsigned long total_blocks = stat.f_blocks;
+    unsigned long free_blocks = stat.f_bfree;
+    int disk_usage = ((total_blocks - free_blocks) * 100) / total_blocks;
+    
+    return disk_usage;
+}
+
+int get_battery_percentage() {
+    char buffer[16];
+    read_first_line("/sys/class/power_supply/BAT0/capacity", buffer, sizeof(buffer));
+    return atoi(buffer);
+}
+
+int get_cpu_temperature() {
+    char buffer[16];
+    read_first_line("/sys/class/thermal/thermal_zone0/temp", buffer, sizeof(buffer));
+    return atoi(buffer) / 1000;
+}
+
+// Fill a w x h rectangle at (x, y), clipped to the screen
+static void fill_rect(uint8_t *framebuffer, struct fb_var_screeninfo vinfo, int x, int y, int w, int h, int color) {
+    if (x < 0) { w += x; x = 0; }
+    if (y < 0) { h += y; y = 0; }
+    if (x + w > (int)vinfo.xres_virtual) w = vinfo.xres_virtual - x;
+    if (y + h > (int)vinfo.yres_virtual) h = vinfo.yres_virtual - y;
+    if (w <= 0 || h <= 0) return;
+    for (int row = y; row < y + h; ++row) {
+        memset(framebuffer + (size_t)row * vinfo.xres_virtual + x, color, w);
+    }
+    PROF_COUNT(PROF_PIXELS, w * h);
+}
+
+// Draw a filled percentage bar followed by the dim rest of its track, five glyphs wide
+void draw_percentage_bar(uint8_t *framebuffer, struct fb_var_screeninfo vinfo, int x, int y, int percentage, int size, int color) {
+    int width = 5 * size * 4;
+    int height = 5 * size;
+    if (percentage < 0) percentage = 0;
+    if (percentage > 100) percentage = 100;
+    int filled = width * percentage / 100;
+    fill_rect(framebuffer, vinfo, x, y, filled, height, color);
+    fill_rect(framebuffer, vinfo, x + filled, y, width - filled, height, PAL_BAR_TRACK);
+}
+
+// Update system info on the screen
+void update_system_info(uint8_t *framebuffer, struct fb_var_screeninfo vinfo) {
+    int battery_percentage = get_battery_percentage();
+    int cpu_usage = get_cpu_usage();
+    int ram_usage = get_ram_usage();
+    int disk_usage = get_disk_usage();
+    int cpu_temp = get_cpu_temperature();
+
+    char buffer[80];
+    struct stats_box box = layout_stats(vinfo);
+    int left = box.x, top = box.y;
+    int right = left + STATS_LABELS;  // Bars
+
+    // Draw battery info
+    sprintf(buffer, "Battery: %d%%", battery_percentage);
+    draw_text(framebuffer, vinfo, buffer, left, top, 2, PAL_WHITE);
+    draw_percentage_bar(framebuffer, vinfo, right, top, battery_percentage, 2, PAL_WHITE);
+
+    // Draw CPU usage
+    sprintf(buffer, "CPU: %d%% Temp: %d°C", cpu_usage, cpu_temp);
+    draw_text(framebuffer, vinfo, buffer, left, top + STATS_ROW, 2, PAL_WHITE);
+    draw_percentage_bar(framebuffer, vinfo, right, top + STATS_ROW, cpu_usage, 2, PAL_WHITE);
+
+    // Draw RAM usage
+    sprintf(buffer, "RAM: %d%%", ram_usage);
+    draw_text(framebuffer, vinfo, buffer, left, top + 2 * STATS_ROW, 2, PAL_WHITE);
+    draw_percentage_bar(framebuffer, vinfo, right, top + 2 * STATS_ROW, ram_usage, 2, PAL_WHITE);
+
+    // Draw Disk usage
+    sprintf(buffer, "Disk: %d%%", disk_usage);
+    draw_text(framebuffer, vinfo, buffer, left, top + 3 * STATS_ROW, 2, PAL_WHITE);
+    draw_percentage_bar(framebuffer, vinfo, right, top + 3 * STATS_ROW, disk_usage, 2, PAL_WHITE);
+}
+
+static long long monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+long long countdown_remaining_ns(void) {
+    if (!countdown_running) return countdown_left_ns;
+    long long left = countdown_deadline_ns - monotonic_ns();
+    return left > 0 ? left : 0;
+}
+
+// Arc buckets still lit for this much time left, rounded up so the arc
+// only empties at zero
+static int countdown_arc_steps(long long left_ns) {
+    return (int)((left_ns * ARC_STEPS + TIMER_START_VALUE * NS_PER_SEC - 1) / (TIMER_START_VALUE * NS_PER_SEC));
+}
+
+// Seconds and tenths, rounded up like the arc
+static void format_countdown(char *text, size_t size, long long left_ns) {
+    long long tenths = (left_ns + NS_PER_SEC / 10 - 1) / (NS_PER_SEC / 10);
+    snprintf(text, size, "%lld.%lld", tenths / 10, tenths % 10);
+}
+
+// Ring and arc pixel tables for this geometry; call once at startup
+int init_countdown_rings(struct fb_var_screeninfo vinfo) {
+    if (arc_init(&static_ring, vinfo, CENTER_X, CENTER_Y, RADIUS - 2, RADIUS + 2) != 0 ||
+        arc_init(&countdown_arc, vinfo, CENTER_X, CENTER_Y, RADIUS - 16, RADIUS - 9) != 0) {
+        perror("Error building ring tables");
+        return -1;
+    }
+    return 0;
+}
+
 // Draw the static ring for the clock face
-void draw_static_ring(int *framebuffer, struct fb_var_screeninfo vinfo) {
-    draw_ring(framebuffer, vinfo, CENTER_X, CENTER_Y, RADIUS, 5, RING_COLOR); // Draw a thick white ring
+void draw_static_ring(uint8_t *framebuffer, struct fb_var_screeninfo vinfo) {
+    arc_fill(&static_ring, framebuffer, 0, ARC_STEPS, RING_COLOR); // Draw a thick white ring
 }
 
-// Draw the dynamic ring with decreasing radius
-void draw_dynamic_ring(int *framebuffer, struct fb_var_screeninfo vinfo) {
-    int dynamic_radius = RADIUS * countdown / TIMER_START_VALUE;  // Scale the radius based on remaining time
-    draw_ring(framebuffer, vinfo, CENTER_X, CENTER_Y, dynamic_radius, 3, TIMER_COLOR); // Draw an orange ring
+// Draw the countdown arc: the time left, clockwise from 12 o'clock, over a dim track
+void draw_dynamic_ring(uint8_t *framebuffer, struct fb_var_screeninfo vinfo) {
+    arc_draw(&countdown_arc, framebuffer, countdown_arc_steps(countdown_remaining_ns()), PAL_ARC, PAL_ARC_BANDS, PAL_TRACK);
 }
 
 // Draw the countdown timer inside the ring
-void draw_countdown_timer(int *framebuffer, struct fb_var_screeninfo vinfo) {
-    char timer_text[10];
-    sprintf(timer_text, "%d", countdown);
-    draw_text(framebuffer, vinfo, timer_text, CENTER_X - 10, CENTER_Y - 10, 3, TIMER_COLOR); // Center the text
+void draw_countdown_timer(uint8_t *framebuffer, struct fb_var_screeninfo vinfo) {
+    format_countdown(countdown_drawn, sizeof(countdown_drawn), countdown_remaining_ns());
+    countdown_drawn_x = CENTER_X - (int)strlen(countdown_drawn) * 6;  // Glyphs advance 12 px at size 3
+    draw_text(framebuffer, vinfo, countdown_drawn, countdown_drawn_x, COUNTDOWN_TOP, 3, TIMER_COLOR);
+}
+
+// Blank one size-3 glyph cell
+static void clear_glyph(uint8_t *framebuffer, struct fb_var_screeninfo vinfo, int x, int y) {
+    for (int row = 0; row < 15; row++) {
+        for (int col = 0; col < 9; col++) {
+            set_pixel(framebuffer, vinfo, x + col, y + row, 0);
+        }
+    }
+}
+
+// One animation frame: move the end of the arc and redraw only the glyphs
+// whose digit changed (all of them when the text changes length)
+int update_countdown(uint8_t *framebuffer, struct fb_var_screeninfo vinfo) {
+    long long left = countdown_remaining_ns();
+    int pixels = arc_update(&countdown_arc, framebuffer, countdown_arc_steps(left), PAL_ARC, PAL_ARC_BANDS, PAL_TRACK);
+
+    char text[16];
+    format_countdown(text, sizeof(text), left);
+    size_t len = strlen(text);
+    int y = COUNTDOWN_TOP;
+    glyphs_from = INT_MAX;
+    glyphs_to = INT_MIN;
+    if (len != strlen(countdown_drawn)) {
+        for (size_t i = 0; countdown_drawn[i]; i++) clear_glyph(framebuffer, vinfo, countdown_drawn_x + 12 * i, y);
+        glyphs_from = countdown_drawn_x;
+        glyphs_to = countdown_drawn_x + 12 * (int)strlen(countdown_drawn);
+        memset(countdown_drawn, 0, sizeof(countdown_drawn));
+        countdown_drawn_x = CENTER_X - (int)len * 6;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (text[i] == countdown_drawn[i]) continue;
+        int x = countdown_drawn_x + 12 * i;
+        clear_glyph(framebuffer, vinfo, x, y);
+        draw_char(framebuffer, vinfo, text[i], x, y, 3, TIMER_COLOR);
+        if (x < glyphs_from) glyphs_from = x;
+        if (x + 12 > glyphs_to) glyphs_to = x + 12;
+        pixels += 15 * 9;
+    }
+    memcpy(countdown_drawn, text, len + 1);
+    return pixels;
 }
 
 // Draw the clock face with rings and numbers
-void draw_clock_face(int *framebuffer, struct fb_var_screeninfo vinfo) {
-    memset(framebuffer, 0, vinfo.yres_virtual * vinfo.xres_virtual * sizeof(int)); // Clear screen
+void draw_clock_face(uint8_t *framebuffer, struct fb_var_screeninfo vinfo) {
+    PROF_BEGIN(PROF_CLEAR);
+    memset(framebuffer, PAL_BLACK, vinfo.yres_virtual * vinfo.xres_virtual); // Clear screen
+    PROF_COUNT(PROF_PIXELS, vinfo.yres_virtual * vinfo.xres_virtual);
+    PROF_END(PROF_CLEAR);
+
+    PROF_BEGIN(PROF_RASTERIZE);
     draw_static_ring(framebuffer, vinfo);     // Draw the static white ring
     draw_dynamic_ring(framebuffer, vinfo);    // Draw the dynamic orange ring
+    PROF_END(PROF_RASTERIZE);
+
+    PROF_BEGIN(PROF_TEXT);
     draw_countdown_timer(framebuffer, vinfo); // Draw the countdown timer
+    PROF_END(PROF_TEXT);
 }
 
-// Update the clock hands, date/time display, and system information
-void update_time(int *framebuffer, struct fb_var_screeninfo vinfo) {
+// Update the clock hands, date/time display, and system information. The
+// countdown is part of the face: draw_clock_face() draws it, once a frame.
+void update_time(uint8_t *framebuffer, struct fb_var_screeninfo vinfo) {
     time_t rawtime;
     struct tm *timeinfo;
     char date_buffer[80];
@@ -70,63 +368,322 @@ void update_time(int *framebuffer, struct fb_var_screeninfo vinfo) {
     time(&rawtime);
     timeinfo = localtime(&rawtime);
 
+#ifdef FB_FIXED_POINT
+    // Same angles as below, counted in half degrees
+    angle_t hour_angle = fx_deg(180 - (60 * (timeinfo->tm_hour % 12) + timeinfo->tm_min), 2);
+    angle_t minute_angle = fx_deg(90 - 6 * timeinfo->tm_min, 1);
+#else
     float hour_angle_degrees = (30 * (timeinfo->tm_hour % 12)) + (timeinfo->tm_min * 0.5);
     float hour_angle = -hour_angle_degrees * M_PI / 180.0 + M_PI / 2;
 
     float minute_angle_degrees = 6 * timeinfo->tm_min;
     float minute_angle = -minute_angle_degrees * M_PI / 180.0 + M_PI / 2;
+#endif
 
-    draw_hand(framebuffer, vinfo, hour_angle, HOUR_HAND_LENGTH, 0xFFFFFF);    // Hour hand
-    draw_hand(framebuffer, vinfo, minute_angle, MINUTE_HAND_LENGTH, 0xFFFFFF); // Minute hand
+    PROF_BEGIN(PROF_RASTERIZE);
+    draw_hand(framebuffer, vinfo, hour_angle, HOUR_HAND_LENGTH, PAL_WHITE);    // Hour hand
+    draw_hand(framebuffer, vinfo, minute_angle, MINUTE_HAND_LENGTH, PAL_WHITE); // Minute hand
+    PROF_END(PROF_RASTERIZE);
 
+    PROF_BEGIN(PROF_TEXT);
     strftime(date_buffer, sizeof(date_buffer), "%Y-%m-%d", timeinfo);
-    draw_text(framebuffer, vinfo, date_buffer, CENTER_X - 100, CENTER_Y + 200, 3, 0xFFFFFF);
+    draw_text(framebuffer, vinfo, date_buffer, CENTER_X - 100, CENTER_Y + 200, 3, PAL_WHITE);
 
     strftime(time_buffer, sizeof(time_buffer), "%H:%M:%S", timeinfo);
-    draw_text(framebuffer, vinfo, time_buffer, CENTER_X - 80, CENTER_Y + 250, 3, 0xFFFFFF);
+    draw_text(framebuffer, vinfo, time_buffer, CENTER_X - 80, CENTER_Y + 250, 3, PAL_WHITE);
+    PROF_END(PROF_TEXT);
 
+    PROF_BEGIN(PROF_SYSINFO);
     update_system_info(framebuffer, vinfo); // Display system info
+    PROF_END(PROF_SYSINFO);
+}
+
+struct timer_state {
+    uint8_t *framebuffer;
+    struct fb_var_screeninfo vinfo;
+    int frame_timer;    // Countdown animation, armed only while it runs
+    int fbfd;
+    uint32_t *truecolor; // The device on a 32 bpp panel, NULL when it takes indices
+};
 
-    // Countdown timer logic
-    draw_countdown_timer(framebuffer, vinfo);
+// Starting colours; animate_palette() moves the ring and arc entries on from here
+static void init_timer_palette(struct palette *pal) {
+    palette_set(pal, PAL_BLACK, 0x000000);
+    palette_set(pal, PAL_WHITE, 0xFFFFFF);
+    palette_set(pal, PAL_RING, 0xFFFFFF);
+    palette_set(pal, PAL_TIMER, 0xFFA500);
+    palette_set(pal, PAL_TRACK, 0x3A2500);
+    palette_set(pal, PAL_BAR_TRACK, 0x303030);
+    // Orange to red and back, so cycling the entries has no seam
+    palette_ramp(pal, PAL_ARC, PAL_ARC_BANDS / 2, 0xFFA500, 0xFF3000);
+    palette_ramp(pal, PAL_ARC + PAL_ARC_BANDS / 2, PAL_ARC_BANDS / 2, 0xFF3000, 0xFFA500);
+    memcpy(arc_ramp, &pal->lut[PAL_ARC], sizeof(arc_ramp));
+}
 
-    if (countdown > 0) {
-        countdown--;
+// While the countdown runs the arc's colours flow along it and the ring
+// pulses once a second, red for the last ten; at rest both go back. On
+// truecolor every pixel of an entry has to be written again when it
+// changes, so there the ring only turns red, with the next full frame.
+static void animate_palette(struct palette *pal) {
+    int shift = 0;
+    uint32_t ring = 0xFFFFFF;
+    if (countdown_running) {
+        long long left = countdown_remaining_ns();
+        int level = 0xFF;
+        if (pal->pseudocolor) {
+            int ms = (int)(left / 1000000 % 1000);
+            level = 0x80 + 0x7F * abs(2 * ms - 1000) / 1000;  // Triangle wave, 0x80..0xFF
+            shift = (int)(left / 40000000 % PAL_ARC_BANDS);
+        }
+        ring = left < 10 * NS_PER_SEC ? (uint32_t)level << 16 : (uint32_t)level * 0x010101;
+    }
+    palette_set(pal, PAL_RING, ring);
+    for (int i = 0; i < PAL_ARC_BANDS; i++) {
+        palette_set(pal, PAL_ARC + i, arc_ramp[(i + shift) % PAL_ARC_BANDS]);
     }
 }
 
+// Copy the rows [y0, y1) x columns [x0, x1) of the indices out to a truecolor device
+static void expand_rect(struct timer_state *state, int x0, int x1, int y0, int y1) {
+    int stride = state->vinfo.xres_virtual;
+    if (x0 < 0) x0 = 0;
+    if (x1 > stride) x1 = stride;
+    if (y0 < 0) y0 = 0;
+    if (y1 > (int)state->vinfo.yres_virtual) y1 = state->vinfo.yres_virtual;
+    for (int y = y0; y < y1 && x0 < x1; y++) {
+        size_t row = (size_t)y * stride + x0;
+        palette_expand(state->truecolor + row, state->framebuffer + row, x1 - x0, timer_palette.lut);
+        PROF_COUNT(PROF_BYTES_FLUSHED, (size_t)(x1 - x0) * 4);
+    }
+}
+
+// The pixels of an arc its last arc_update() wrote
+static void expand_arc_changes(struct timer_state *state, const struct arc *arc) {
+    int count = arc->changed_to - arc->changed_from;
+    palette_expand_pixels(state->truecolor, state->framebuffer, arc->offsets + arc->changed_from, count, timer_palette.lut);
+    PROF_COUNT(PROF_BYTES_FLUSHED, (size_t)count * 4);
+}
+
+void render_frame(void *ctx) {
+    struct timer_state *state = ctx;
+    PROF_FRAME_BEGIN();
+    draw_clock_face(state->framebuffer, state->vinfo);
+    update_time(state->framebuffer, state->vinfo);
+    if (state->truecolor) {
+        animate_palette(&timer_palette);  // The ring's colour, red for the last ten
+        PROF_BEGIN(PROF_FLUSH);
+        expand_rect(state, 0, state->vinfo.xres_virtual, 0, state->vinfo.yres_virtual);
+        PROF_END(PROF_FLUSH);
+    }
+    PROF_FRAME_END();
+}
+
+// Stop at zero and only animate while the countdown runs and is on screen.
+// The colours at rest go out now on pseudocolor, with the next full frame
+// on truecolor. While another VT owns the device neither touches it;
+// on_vt_change() reloads the colormap and a repaint follows on return.
+static void sync_countdown(struct evloop *loop, struct timer_state *state) {
+    if (countdown_running && countdown_remaining_ns() == 0) {
+        countdown_running = 0;
+        countdown_left_ns = 0;
+    }
+    animate_palette(&timer_palette);
+    if (!timer_palette.pseudocolor) {
+        loop->dirty = 1;
+    } else if (!loop->suspended) {
+        palette_commit(&timer_palette, state->fbfd);
+    }
+    evloop_set_timer(loop, state->frame_timer, countdown_running && !loop->suspended ? FRAME_INTERVAL_NS : 0);
+}
+
+// Once per second, on the second: repaint the wall clock and stats
+void on_clock_tick(struct evloop *loop, uint64_t expirations, void *ctx) {
+    struct timer_state *state = ctx;
+    if (countdown_running && countdown_remaining_ns() == 0) sync_countdown(loop, state);
+    loop->dirty = 1;
+}
+
+// 60 times a second while running: move the arc and digits on, nothing else
+void on_frame_tick(struct evloop *loop, uint64_t expirations, void *ctx) {
+    struct timer_state *state = ctx;
+    PROF_FRAME_BEGIN();
+    PROF_BEGIN(PROF_RASTERIZE);
+    update_countdown(state->framebuffer, state->vinfo);
+    PROF_END(PROF_RASTERIZE);
+    PROF_BEGIN(PROF_FLUSH);
+    if (state->truecolor) {
+        // Only what update_countdown() wrote: the arc's end and the digits
+        // that changed. The entries hold still between full frames.
+        expand_arc_changes(state, &countdown_arc);
+        struct fb_var_screeninfo vinfo = state->vinfo;  // For COUNTDOWN_TOP
+        expand_rect(state, glyphs_from, glyphs_to, COUNTDOWN_TOP, COUNTDOWN_TOP + 15);
+    } else {
+        animate_palette(&timer_palette);
+        palette_commit(&timer_palette, state->fbfd);
+    }
+    PROF_END(PROF_FLUSH);
+    PROF_FRAME_END();
+    if (countdown_remaining_ns() == 0) sync_countdown(loop, state);
+}
+
+// No animation while another VT is in front; vt.c repaints on return. The
+// other VT may have loaded its own colormap, so ours goes back in full.
+void on_vt_change(struct evloop *loop, int visible, void *ctx) {
+    struct timer_state *state = ctx;
+    if (visible) palette_touch_all(&timer_palette);
+    sync_countdown(loop, state);
+}
+
+// Space/p starts or pauses the countdown, r resets it, q/Esc quits
+void on_key(struct evloop *loop, int key, void *ctx) {
+    switch (key) {
+        case KEY_SPACE:
+        case KEY_P:
+            if (countdown_running) {
+                countdown_left_ns = countdown_remaining_ns();
+                countdown_running = 0;
+            } else if (countdown_left_ns > 0) {
+                countdown_deadline_ns = monotonic_ns() + countdown_left_ns;
+                countdown_running = 1;
+            }
+            sync_countdown(loop, ctx);
+            break;
+        case KEY_R:
+            countdown_left_ns = TIMER_START_VALUE * NS_PER_SEC;
+            countdown_running = 0;
+            sync_countdown(loop, ctx);
+            break;
+        case KEY_Q:
+        case KEY_ESC:
+            loop->running = 0;
+            return;
+        default:
+            return;
+    }
+    loop->dirty = 1;
+}
+
+// The mode the device was in before -8, put back on every way out
+static struct fb_var_screeninfo original_vinfo;
+static int mode_switched;
+
+static void restore_mode(int fbfd) {
+    if (mode_switched && ioctl(fbfd, FBIOPUT_VSCREENINFO, &original_vinfo) != 0) {
+        perror("Error restoring the display mode");
+    }
+    mode_switched = 0;
+}
+
+// Give up after the device has been opened: colormap and mode go back first
+static void fail(int fbfd, int status) {
+    palette_restore(&timer_palette, fbfd);
+    restore_mode(fbfd);
+    close(fbfd);
+    exit(status);
+}
+
 // Main function to continuously update the clock
-int main() {
-    int fbfd = open("/dev/fb0", O_RDWR);
+int main(int argc, char *argv[]) {
+    // -8 switches the device to 8 bpp pseudocolor for palette animation
+    int want_8bpp = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "8")) != -1) {
+        if (opt != '8') {
+            fprintf(stderr, "Usage: %s [-8]\n", argv[0]);
+            exit(1);
+        }
+        want_8bpp = 1;
+    }
+
+    const char *device = getenv("FRAMEBUFFER");  // e.g. /dev/fb1, as for other framebuffer programs
+    int fbfd = open(device != NULL ? device : "/dev/fb0", O_RDWR);
     if (fbfd == -1) {
         perror("Error: cannot open framebuffer device");
         exit(1);
     }
 
     struct fb_var_screeninfo vinfo;
+    struct fb_fix_screeninfo finfo;
     if (ioctl(fbfd, FBIOGET_VSCREENINFO, &vinfo)) {
         perror("Error reading variable information");
         close(fbfd);
         exit(2);
     }
+    original_vinfo = vinfo;
+    if (want_8bpp && vinfo.bits_per_pixel != 8) {
+        vinfo.bits_per_pixel = 8;
+        mode_switched = ioctl(fbfd, FBIOPUT_VSCREENINFO, &vinfo) == 0;
+        if (!mode_switched || ioctl(fbfd, FBIOGET_VSCREENINFO, &vinfo)) {
+            perror("Error switching to 8 bpp");
+            restore_mode(fbfd);
+            vinfo = original_vinfo;
+        }
+    }
+    if (ioctl(fbfd, FBIOGET_FSCREENINFO, &finfo)) {
+        perror("Error reading fixed information");
+        fail(fbfd, 2);
+    }
+
+    // Pixels are drawn as palette indices: straight into an 8 bpp
+    // pseudocolor device, or into memory and expanded to a 32 bpp one
+    palette_open(&timer_palette, fbfd, vinfo, finfo);
+    int bytes = timer_palette.pseudocolor ? 1 : 4;
+    if ((!timer_palette.pseudocolor && vinfo.bits_per_pixel != 32) || finfo.line_length != vinfo.xres_virtual * bytes) {
+        fprintf(stderr, "Error: need an 8 bpp pseudocolor or 32 bpp truecolor framebuffer with unpadded rows\n");
+        fail(fbfd, 2);
+    }
 
-    size_t screensize = vinfo.yres_virtual * vinfo.xres_virtual * vinfo.bits_per_pixel / 8;
-    int *framebuffer = (int *)mmap(0, screensize, PROT_READ | PROT_WRITE, MAP_SHARED, fbfd, 0);
-    if (framebuffer == MAP_FAILED) {
+    size_t screensize = (size_t)vinfo.yres_virtual * finfo.line_length;
+    void *device_map = mmap(0, screensize, PROT_READ | PROT_WRITE, MAP_SHARED, fbfd, 0);
+    if (device_map == MAP_FAILED) {
         perror("Error mapping framebuffer device to memory");
-        close(fbfd);
-        exit(3);
+        fail(fbfd, 3);
+    }
+    uint8_t *framebuffer = device_map;
+    uint32_t *truecolor = NULL;
+    if (!timer_palette.pseudocolor) {
+        truecolor = device_map;
+        framebuffer = malloc((size_t)vinfo.yres_virtual * vinfo.xres_virtual);
+        if (framebuffer == NULL) {
+            perror("Error allocating index buffer");
+            fail(fbfd, 3);
+        }
     }
+    init_timer_palette(&timer_palette);
+    palette_touch_all(&timer_palette);
+    palette_commit(&timer_palette, fbfd);
 
-    // Continuously update the clock
-    while (1) {
-        draw_clock_face(framebuffer, vinfo);
-        update_time(framebuffer, vinfo);
-        sleep(1); // Sleep for 1 second to update the clock every second
+    if (init_countdown_rings(vinfo) != 0) fail(fbfd, 4);
+
+    // Full redraw on each clock tick and on input, the countdown alone in
+    // between; returns on q or SIGINT/SIGTERM
+    struct timer_state state = { framebuffer, vinfo, -1, fbfd, truecolor };
+    struct evloop loop;
+    if (evloop_init(&loop) != 0 || evloop_add_timer(&loop, 1000000000L, 1, on_clock_tick, &state) < 0) {
+        fail(fbfd, 4);
     }
+    countdown_deadline_ns = monotonic_ns() + countdown_left_ns;
+    state.frame_timer = evloop_add_timer(&loop, FRAME_INTERVAL_NS, 0, on_frame_tick, &state);
+    if (state.frame_timer < 0) fail(fbfd, 4);
+    evloop_add_input(&loop, on_key, &state);
+
+    // While another VT is in front the countdown keeps going against its
+    // deadline but nothing is drawn; the whole face is repainted when we come back
+    struct vt_state vt;
+    vt_init(&vt, &loop, on_vt_change, &state);
+    PROF_INIT("timer");
+    evloop_run(&loop, render_frame, &state);
+    PROF_SHUTDOWN();
+    vt_restore(&vt);
+    evloop_close(&loop);
 
     // Cleanup
-    munmap(framebuffer, screensize);
+    arc_free(&static_ring);
+    arc_free(&countdown_arc);
+    palette_restore(&timer_palette, fbfd);
+    if (truecolor) free(framebuffer);
+    munmap(device_map, screensize);
+    restore_mode(fbfd);
     close(fbfd);
 
     return 0;
@@ -0,0 +1,103 @@
+#include "../include/profile.h"
+
+#ifdef FB_PROFILE
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+__thread struct prof_local prof_tls;
+
+static struct prof_file *prof_map = NULL;
+
+// Create the shared stats file and map it
+void prof_init(const char *name) {
+    char path[256];
+    const char *env = getenv("FB_PROFILE_FILE");
+    if (env != NULL) {
+        snprintf(path, sizeof(path), "%s", env);
+    } else {
+        snprintf(path, sizeof(path), "/dev/shm/%s.prof", name);
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        perror("Error creating profile stats file");
+        return;
+    }
+    if (ftruncate(fd, sizeof(struct prof_file)) == -1) {
+        perror("Error sizing profile stats file");
+        close(fd);
+        return;
+    }
+    struct prof_file *map = mmap(NULL, sizeof(struct prof_file), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("Error mapping profile stats file");
+        return;
+    }
+
+    map->version = PROF_VERSION;
+    map->stage_count = PROF_STAGE_COUNT;
+    map->counter_count = PROF_COUNTER_COUNT;
+    map->hist_buckets = PROF_HIST_BUCKETS;
+    snprintf(map->name, sizeof(map->name), "%s", name);
+    // Readers check the magic last so they never see a half-written header
+    __atomic_store_n(&map->magic, PROF_MAGIC, __ATOMIC_RELEASE);
+    prof_map = map;
+    fprintf(stderr, "Profiling to %s\n", path);
+}
+
+void prof_shutdown(void) {
+    if (prof_map == NULL) return;
+    prof_publish();
+    munmap(prof_map, sizeof(struct prof_file));
+    prof_map = NULL;
+}
+
+// Claim a slot in the stats file for the calling thread
+static struct prof_slot *prof_claim_slot(void) {
+    if (prof_map == NULL) return NULL;
+    uint32_t index = __atomic_fetch_add(&prof_map->nthreads, 1, __ATOMIC_RELAXED);
+    if (index >= PROF_MAX_THREADS) {
+        __atomic_fetch_sub(&prof_map->nthreads, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    struct prof_slot *slot = &prof_map->slots[index];
+    slot->tid = (int32_t)syscall(SYS_gettid);
+    return slot;
+}
+
+// Copy this thread's totals into its slot, bracketed by the seq counter
+void prof_publish(void) {
+    struct prof_slot *slot = prof_tls.slot;
+    if (slot == NULL) {
+        slot = prof_tls.slot = prof_claim_slot();
+        if (slot == NULL) return;
+    }
+
+    const size_t offset = offsetof(struct prof_slot, frames);
+    uint32_t seq = slot->seq;
+    __atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy((char *)slot + offset, (char *)&prof_tls.acc + offset, sizeof(struct prof_slot) - offset);
+    __atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void prof_frame_end(uint64_t frame_ns) {
+    uint64_t us = frame_ns / 1000;
+    int bucket = us == 0 ? 0 : 64 - __builtin_clzll(us);
+    if (bucket >= PROF_HIST_BUCKETS) bucket = PROF_HIST_BUCKETS - 1;
+
+    prof_tls.acc.frame_hist[bucket]++;
+    prof_tls.acc.frames++;
+    prof_tls.acc.last_frame_ns = frame_ns;
+    prof_publish();
+}
+
+#endif
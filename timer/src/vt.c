@@ -0,0 +1,70 @@
+#include "../include/vt.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/vt.h>
+
+// The kernel wants to switch away from our VT
+static void vt_release(struct evloop *loop, int signo, void *ctx) {
+    struct vt_state *vt = ctx;
+    vt->visible = 0;
+    loop->suspended = 1;
+    if (vt->on_change) vt->on_change(loop, 0, vt->ctx);
+    ioctl(vt->fd, VT_RELDISP, 1);
+}
+
+// Our VT is in front again: repaint once
+static void vt_acquire(struct evloop *loop, int signo, void *ctx) {
+    struct vt_state *vt = ctx;
+    ioctl(vt->fd, VT_RELDISP, VT_ACKACQ);
+    vt->visible = 1;
+    loop->suspended = 0;
+    loop->dirty = 1;
+    if (vt->on_change) vt->on_change(loop, 1, vt->ctx);
+}
+
+int vt_init(struct vt_state *vt, struct evloop *loop, vt_change_fn fn, void *ctx) {
+    memset(vt, 0, sizeof(*vt));
+    vt->visible = 1;
+    vt->on_change = fn;
+    vt->ctx = ctx;
+
+    vt->fd = open("/dev/tty", O_RDWR | O_CLOEXEC);
+    if (vt->fd == -1) return -1;
+    struct vt_mode mode;
+    if (ioctl(vt->fd, VT_GETMODE, &mode) == -1) {
+        close(vt->fd);  // Not a virtual terminal
+        vt->fd = -1;
+        return -1;
+    }
+
+    // Signals have to be routed to the loop before the kernel starts sending them
+    if (evloop_on_signal(loop, SIGUSR1, vt_release, vt) != 0 ||
+        evloop_on_signal(loop, SIGUSR2, vt_acquire, vt) != 0) {
+        return -1;
+    }
+
+    mode.mode = VT_PROCESS;
+    mode.waitv = 0;
+    mode.relsig = SIGUSR1;
+    mode.acqsig = SIGUSR2;
+    if (ioctl(vt->fd, VT_SETMODE, &mode) == -1) {
+        perror("Error setting VT mode");
+        close(vt->fd);
+        vt->fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+void vt_restore(struct vt_state *vt) {
+    if (vt->fd == -1) return;
+    struct vt_mode mode;
+    memset(&mode, 0, sizeof(mode));
+    mode.mode = VT_AUTO;
+    ioctl(vt->fd, VT_SETMODE, &mode);
+    close(vt->fd);
+    vt->fd = -1;
+}